@@ -0,0 +1,104 @@
+/* baselines.cpp
+   Reference sorts on the same input as Serial/bitonic and OpenMP/bitonicOmp02:
+   qsort, std::sort, std::sort(std::execution::par_unseq) and __gnu_parallel::sort.
+   Data generation (srand(42), rand() % 10000), timing (the sort call only) and
+   verification (order + multiset hash) match the bitonic drivers, so their
+   "Execution time" lines compare directly.
+   Compile: g++ -O2 -fopenmp -std=c++17 baselines.cpp -o baselines -ltbb
+            (add -DNO_PAR_UNSEQ when the parallel STL backend is unavailable)
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <omp.h>
+#include <parallel/algorithm>
+#ifndef NO_PAR_UNSEQ
+#include <execution>
+#endif
+
+// Input fill and verification (order + multiset hash) of the bitonic drivers
+#include "../Common/bitonic_common.h"
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static void sort_qsort(std::vector<int> &v) { qsort(v.data(), v.size(), sizeof(int), compare_int); }
+static void sort_std(std::vector<int> &v) { std::sort(v.begin(), v.end()); }
+#ifndef NO_PAR_UNSEQ
+static void sort_par_unseq(std::vector<int> &v) { std::sort(std::execution::par_unseq, v.begin(), v.end()); }
+#endif
+static void sort_gnu_parallel(std::vector<int> &v) { __gnu_parallel::sort(v.begin(), v.end()); }
+
+struct baseline_t {
+    const char *name;   // --sort= selector
+    const char *title;
+    void (*sort)(std::vector<int> &);
+};
+
+static const baseline_t baselines[] = {
+    { "qsort", "qsort", sort_qsort },
+    { "std", "std::sort", sort_std },
+#ifndef NO_PAR_UNSEQ
+    { "par_unseq", "std::sort(par_unseq)", sort_par_unseq },
+#endif
+    { "gnu_parallel", "__gnu_parallel::sort", sort_gnu_parallel },
+};
+
+int main(int argc, char *argv[]) {
+    size_t n = 1024;
+    int num_threads = omp_get_max_threads();
+
+    // Positional arguments are n and num_threads; options start with "--"
+    const char *pos[2] = { NULL, NULL };
+    int npos = 0;
+    const char *which = "all";   // --sort=all|qsort|std|par_unseq|gnu_parallel
+    for (int a = 1; a < argc; a++) {
+        if (strncmp(argv[a], "--sort=", 7) == 0) which = argv[a] + 7;
+        else if (npos < 2) pos[npos++] = argv[a];
+    }
+    if (npos > 0) {
+        long long v = atoll(pos[0]);
+        n = v > 0 ? (size_t)v : 0;
+    }
+    if (npos > 1) {
+        num_threads = atoi(pos[1]);
+        omp_set_num_threads(num_threads);   // __gnu_parallel; TBB follows the machine
+    }
+    if (n == 0) {
+        printf("Number of elements must be positive.\n");
+        return 1;
+    }
+
+    std::vector<int> arr(n);
+    int ran = 0;
+    for (const baseline_t &b : baselines) {
+        if (strcmp(which, "all") != 0 && strcmp(which, b.name) != 0) continue;
+        ran = 1;
+
+        srand(42);
+        uint64_t in_hash = fill_keys(KEYS_INT, arr.data(), n, n);
+
+        printf("Baseline %s - Array size: %zu, Threads: %d\n", b.title, n, num_threads);
+        double start_time = omp_get_wtime();
+        b.sort(arr);
+        double end_time = omp_get_wtime();
+        printf("Execution time: %.6f seconds\n", end_time - start_time);
+
+        verify_t v;
+        verify_ints(arr.data(), n, &v);
+        printf("Result: %s\n", v.sorted ? "SORTED" : "NOT SORTED");
+        printf("Checksum: %s (%016llx)\n", v.hash == in_hash ? "MATCH" : "MISMATCH",
+               (unsigned long long)v.hash);
+    }
+    if (!ran) {
+        printf("Unknown sort '%s' (use all, qsort, std, par_unseq or gnu_parallel).\n", which);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,928 @@
+/* bitonic_common.h
+   Everything Serial/bitonic.c, OpenMP/bitonicOmp02.c and MPI/bitonicMPI_fixed.c
+   have in common: runtime statistics, the compare-exchange kernels for every
+   key width, the small-input sort, aligned buffers, the key types (float and
+   128-bit key maps, test input, verification with the multiset hash), the
+   adaptive bitonic tree, comparator network levels, timing and the RAPL
+   reader. The drivers keep their engines and their threading.
+   Everything here has internal linkage, so any number of translation units
+   may include it. Loops the OpenMP driver runs in parallel are marked
+   PARALLEL_FOR, which is empty in a build without -fopenmp.
+*/
+
+#ifndef BITONIC_COMMON_H
+#define BITONIC_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifdef _OPENMP
+#define PARALLEL_FOR _Pragma("omp parallel for schedule(static)")
+#define PARALLEL_FOR_VERIFY _Pragma("omp parallel for reduction(&&:ok) reduction(+:h) schedule(static)")
+#else
+#define PARALLEL_FOR
+#define PARALLEL_FOR_VERIFY
+#endif
+
+// Runtime statistics (build with -DSORT_STATS, see make stats)
+// The kernels count compare-exchanges, swaps that actually moved keys and the
+// keys each memory pass touches per stride class (passes = keys / n); engines
+// add their scratch bytes, OpenMP task sites their task count and depth. Each
+// driver defines stat_self(), the counters the calling thread adds to (one
+// global, one cache line per thread, one set per rank), and how they are reset
+// and summed. Without SORT_STATS every STAT_* macro expands to nothing, so the
+// default build has no counting code.
+#define STAT_CLASSES 4   // stride < 64 B (one line), < 32 KB, < 1 MB, >= 1 MB
+
+typedef struct {
+    unsigned long long compares, swaps;
+    unsigned long long pass_keys[STAT_CLASSES];
+    unsigned long long tasks, max_depth, scratch_bytes;
+} sort_stats_t;
+
+static inline int stat_class(size_t stride) {
+    size_t bytes = stride * sizeof(int);
+    return bytes < 64 ? 0 : bytes < ((size_t)32 << 10) ? 1 : bytes < ((size_t)1 << 20) ? 2 : 3;
+}
+
+// Report lines; passes are the keys touched per stride class over n. ranks > 0
+// for sums over MPI ranks; tasks show up once any were counted
+static inline void sort_stats_print(const sort_stats_t *s, size_t n, int ranks) {
+    printf("Stats");
+    if (ranks > 0) printf(" (%d ranks)", ranks);
+    printf(": %llu compare-exchanges, %llu swaps (%.1f%%), ", s->compares, s->swaps,
+           s->compares ? 100.0 * s->swaps / s->compares : 0.0);
+    if (s->tasks) printf("%llu tasks (max depth %llu), ", s->tasks, s->max_depth);
+    printf("%llu scratch bytes\n", s->scratch_bytes);
+    printf("Stats passes by stride: %.2f (< 64 B), %.2f (< 32 KB), %.2f (< 1 MB), %.2f (>= 1 MB)\n",
+           (double)s->pass_keys[0] / n, (double)s->pass_keys[1] / n,
+           (double)s->pass_keys[2] / n, (double)s->pass_keys[3] / n);
+}
+
+#ifdef SORT_STATS
+static inline sort_stats_t *stat_self(void);   // defined by the driver
+
+#define STAT_ADD(field, v) (stat_self()->field += (v))
+#define STAT_PASS(stride, keys) (stat_self()->pass_keys[stat_class(stride)] += (keys))
+#define STAT_CMPX(x, y, dir) \
+    (stat_self()->compares++, stat_self()->swaps += (dir) ? (x) > (y) : (x) < (y))
+#define STAT_VEC_SWAPS(x, y, lanes, dir) \
+    for (size_t l_ = 0; l_ < (lanes); l_++) STAT_ADD(swaps, (dir) ? (x)[l_] > (y)[l_] : (x)[l_] < (y)[l_])
+#else
+#define STAT_ADD(field, v) ((void)0)
+#define STAT_PASS(stride, keys) ((void)0)
+#define STAT_CMPX(x, y, dir) ((void)0)
+#define STAT_VEC_SWAPS(x, y, lanes, dir) ((void)0)
+#endif
+
+// Branch-free compare-exchange of two register values in direction dir
+#define CMPX(x, y, dir) do {                      \
+        STAT_CMPX(x, y, dir);                     \
+        int lo_ = (x) < (y) ? (x) : (y);          \
+        int hi_ = (x) < (y) ? (y) : (x);          \
+        (x) = (dir) ? lo_ : hi_;                  \
+        (y) = (dir) ? hi_ : lo_;                  \
+    } while (0)
+
+// Multi-level merge kernels for strides beyond the cache
+// Once a merge no longer fits in cache, every level of bitonic_merge is a full
+// streaming pass over it. Above MULTI_LEVEL_MIN the merges load eight elements
+// q apart and run three levels of the butterfly (strides 4q, 2q, q) in
+// registers, so one sweep does the work of three.
+#define MULTI_LEVEL_MIN (1 << 16)  // elements (256 KB of int)
+
+// Levels 4q, 2q and q on p[t + r*q], r = 0..7, t < len
+static inline void compare_exchange_radix8(int *p, size_t q, size_t len, int dir) {
+    STAT_PASS(q, 8 * len);
+    for (size_t t = 0; t < len; t++) {
+        int v0 = p[t],         v1 = p[t + q],     v2 = p[t + 2 * q], v3 = p[t + 3 * q];
+        int v4 = p[t + 4 * q], v5 = p[t + 5 * q], v6 = p[t + 6 * q], v7 = p[t + 7 * q];
+        CMPX(v0, v4, dir); CMPX(v1, v5, dir); CMPX(v2, v6, dir); CMPX(v3, v7, dir);
+        CMPX(v0, v2, dir); CMPX(v1, v3, dir); CMPX(v4, v6, dir); CMPX(v5, v7, dir);
+        CMPX(v0, v1, dir); CMPX(v2, v3, dir); CMPX(v4, v5, dir); CMPX(v6, v7, dir);
+        p[t] = v0;         p[t + q] = v1;     p[t + 2 * q] = v2; p[t + 3 * q] = v3;
+        p[t + 4 * q] = v4; p[t + 5 * q] = v5; p[t + 6 * q] = v6; p[t + 7 * q] = v7;
+    }
+}
+
+// Aligned buffers
+// Engine buffers start on a cache line so power-of-two subarrays line up with
+// vector registers; arrays of 8 MB and more get 2 MB alignment and ask for
+// transparent huge pages to cut TLB misses on large strides.
+#define CACHE_LINE 64
+#define HUGE_PAGE ((size_t)2 << 20)
+
+static inline void *aligned_buffer(size_t bytes) {
+    size_t align = bytes >= 4 * HUGE_PAGE ? HUGE_PAGE : CACHE_LINE;
+    if (bytes == 0) bytes = 1;
+#ifdef _WIN32
+    return _aligned_malloc(bytes, align);
+#else
+    void *p = NULL;
+    if (posix_memalign(&p, align, bytes) != 0) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (align == HUGE_PAGE) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    return p;
+#endif
+}
+
+static inline void free_aligned(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// Vectorized compare-exchange
+// a[t] and b[t] for t < len, branch-free on VEC_INTS-wide vectors. a and b sit a
+// power-of-two stride apart, so they share alignment: a scalar head runs until
+// a is vector aligned (no loads split a cache line), then whole vectors, then a
+// scalar tail. Callers that know a is aligned pass aligned = 1 to skip the head.
+#ifdef __AVX2__
+#define VEC_INTS 8
+#else
+#define VEC_INTS 4
+#endif
+typedef int vint_t __attribute__((vector_size(VEC_INTS * sizeof(int)), aligned(sizeof(int))));
+
+#ifdef SORT_STATS
+static inline int stat_lanes(vint_t m) {   // set lanes are -1
+    int c = 0;
+    for (int i = 0; i < VEC_INTS; i++) c -= m[i];
+    return c;
+}
+#endif
+
+static inline void compare_exchange_run(int *a, int *b, size_t len, int dir, int aligned) {
+    size_t t = 0;
+    STAT_PASS((size_t)(b - a), 2 * len);
+    if (!aligned) {
+        for (; t < len && ((uintptr_t)(a + t) % sizeof(vint_t)) != 0; t++) {
+            int x = a[t], y = b[t];
+            CMPX(x, y, dir);
+            a[t] = x; b[t] = y;
+        }
+    }
+    for (; t + VEC_INTS <= len; t += VEC_INTS) {
+        vint_t x = *(vint_t *)(a + t), y = *(vint_t *)(b + t);
+        vint_t m = x > y;                       // lanes out of ascending order
+        STAT_ADD(compares, VEC_INTS);
+        STAT_ADD(swaps, stat_lanes(dir ? m : y > x));
+        vint_t lo = (y & m) | (x & ~m), hi = (x & m) | (y & ~m);
+        *(vint_t *)(a + t) = dir ? lo : hi;
+        *(vint_t *)(b + t) = dir ? hi : lo;
+    }
+    for (; t < len; t++) {
+        int x = a[t], y = b[t];
+        CMPX(x, y, dir);
+        a[t] = x; b[t] = y;
+    }
+}
+
+// Small-input fast path
+// Request-path sorts of a few thousand keys are dominated by call and thread
+// overhead, not comparisons. Up to SMALL_SORT_MAX keys the sort runs on an
+// aligned stack copy with the flat (k, j) loop of the iterative engine: every
+// 8-key block is sorted and merged by unrolled networks held in registers, and
+// only strides of 8 and up go through the vector compare_exchange_run.
+#define SMALL_SORT_MAX 4096
+
+// Unrolled 8-key bitonic merge (strides 4, 2, 1) in direction dir
+static inline void merge8(int *p, int dir) {
+    STAT_PASS(1, 8);
+    int v0 = p[0], v1 = p[1], v2 = p[2], v3 = p[3], v4 = p[4], v5 = p[5], v6 = p[6], v7 = p[7];
+    CMPX(v0, v4, dir); CMPX(v1, v5, dir); CMPX(v2, v6, dir); CMPX(v3, v7, dir);
+    CMPX(v0, v2, dir); CMPX(v1, v3, dir); CMPX(v4, v6, dir); CMPX(v5, v7, dir);
+    CMPX(v0, v1, dir); CMPX(v2, v3, dir); CMPX(v4, v5, dir); CMPX(v6, v7, dir);
+    p[0] = v0; p[1] = v1; p[2] = v2; p[3] = v3; p[4] = v4; p[5] = v5; p[6] = v6; p[7] = v7;
+}
+
+// Unrolled 8-key bitonic sort (24 comparators) in direction dir
+static inline void sort8(int *p, int dir) {
+    STAT_PASS(1, 8);
+    int v0 = p[0], v1 = p[1], v2 = p[2], v3 = p[3], v4 = p[4], v5 = p[5], v6 = p[6], v7 = p[7];
+    CMPX(v0, v1, 1); CMPX(v2, v3, 0); CMPX(v4, v5, 1); CMPX(v6, v7, 0);
+    CMPX(v0, v2, 1); CMPX(v1, v3, 1); CMPX(v4, v6, 0); CMPX(v5, v7, 0);
+    CMPX(v0, v1, 1); CMPX(v2, v3, 1); CMPX(v4, v5, 0); CMPX(v6, v7, 0);
+    CMPX(v0, v4, dir); CMPX(v1, v5, dir); CMPX(v2, v6, dir); CMPX(v3, v7, dir);
+    CMPX(v0, v2, dir); CMPX(v1, v3, dir); CMPX(v4, v6, dir); CMPX(v5, v7, dir);
+    CMPX(v0, v1, dir); CMPX(v2, v3, dir); CMPX(v4, v5, dir); CMPX(v6, v7, dir);
+    p[0] = v0; p[1] = v1; p[2] = v2; p[3] = v3; p[4] = v4; p[5] = v5; p[6] = v6; p[7] = v7;
+}
+
+// Sort arr[0..n) ascending, n a power of two <= SMALL_SORT_MAX
+static inline void bitonic_sort_small(int arr[], size_t n) {
+    int buf[SMALL_SORT_MAX] __attribute__((aligned(CACHE_LINE)));
+    STAT_ADD(scratch_bytes, sizeof(buf));
+    memcpy(buf, arr, sizeof(int) * n);
+    if (n < 8) {
+        for (size_t k = 2; k <= n; k <<= 1)
+            for (size_t j = k >> 1; j > 0; j >>= 1)
+                for (size_t lo = 0; lo < n; lo += 2 * j)
+                    compare_exchange_run(&buf[lo], &buf[lo + j], j, (lo & k) == 0, 1);
+    } else {
+        for (size_t lo = 0; lo < n; lo += 8) sort8(&buf[lo], n == 8 || (lo & 8) == 0);
+        for (size_t k = 16; k <= n; k <<= 1) {
+            for (size_t j = k >> 1; j >= 8; j >>= 1)
+                for (size_t lo = 0; lo < n; lo += 2 * j)
+                    compare_exchange_run(&buf[lo], &buf[lo + j], j, (lo & k) == 0, 1);
+            for (size_t lo = 0; lo < n; lo += 8) merge8(&buf[lo], (lo & k) == 0);
+        }
+    }
+    memcpy(arr, buf, sizeof(int) * n);
+}
+
+// Other key widths (--keys=double|u16|u8)
+// One template generates the compare-exchange per key type; the drivers wrap
+// it in their own network. The vector part holds VEC_KEY_BYTES / sizeof(T)
+// lanes (int64 2/4/8, u16 8/16/32, u8 16/32/64 on SSE2/AVX2/AVX-512BW), then a
+// scalar tail; there is no radix kernel. Narrow keys move half or a quarter of
+// the bytes of int per pass.
+#if defined(__AVX512BW__)
+#define VEC_KEY_BYTES 64   // vector bytes of the wider-key kernels
+#else
+#define VEC_KEY_BYTES (VEC_INTS * sizeof(int))
+#endif
+
+#define DEFINE_KEY_CMPX(T, sfx)                                                             \
+typedef T v##sfx##_t __attribute__((vector_size(VEC_KEY_BYTES), aligned(sizeof(T))));       \
+                                                                                            \
+static inline void compare_exchange_run_##sfx(T *a, T *b, size_t len, int dir) {            \
+    const size_t lanes = VEC_KEY_BYTES / sizeof(T);                                         \
+    size_t t = 0;                                                                           \
+    STAT_PASS((size_t)(b - a) * sizeof(T) / sizeof(int), 2 * len);                          \
+    STAT_ADD(compares, len);                                                                \
+    for (; t + lanes <= len; t += lanes) {                                                  \
+        v##sfx##_t x = *(v##sfx##_t *)(a + t), y = *(v##sfx##_t *)(b + t);                  \
+        v##sfx##_t m = (v##sfx##_t)(x > y);                                                 \
+        v##sfx##_t lo = (y & m) | (x & ~m), hi = (x & m) | (y & ~m);                        \
+        STAT_VEC_SWAPS(x, y, lanes, dir);                                                   \
+        *(v##sfx##_t *)(a + t) = dir ? lo : hi;                                             \
+        *(v##sfx##_t *)(b + t) = dir ? hi : lo;                                             \
+    }                                                                                       \
+    for (; t < len; t++) {                                                                  \
+        T x = a[t], y = b[t];                                                               \
+        T lo = x < y ? x : y, hi = x < y ? y : x;                                           \
+        STAT_ADD(swaps, dir ? x > y : x < y);                                               \
+        a[t] = dir ? lo : hi;                                                               \
+        b[t] = dir ? hi : lo;                                                               \
+    }                                                                                       \
+}
+
+DEFINE_KEY_CMPX(int64_t, i64)
+DEFINE_KEY_CMPX(uint16_t, u16)
+DEFINE_KEY_CMPX(uint8_t, u8)
+
+// Order-independent multiset hash: sum (mod 2^64) of a 64-bit mix of every
+// key. Equal input and output hashes mean the output is (up to collisions) a
+// permutation of the input, whatever the order.
+static inline uint64_t key_mix64(uint64_t x) {
+    uint64_t z = x + 0x9E3779B97F4A7C15ull;             // splitmix64 finalizer
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t key_mix(int x) { return key_mix64((uint32_t)x); }
+
+// 128-bit keys (--keys=uuid|pair)
+// UUIDs and composite keys such as (tenant, timestamp) sort as one unsigned
+// 128-bit key compared lexicographically on (hi, lo), so no index sort is
+// needed. With AVX2/AVX-512BW the vector compare-exchange holds
+// VEC_KEY_BYTES / 16 keys (2/4): unsigned 64-bit compares on both halves, the
+// lo result shuffled onto the hi lane (gt = hi_gt | hi_eq & lo_gt), that mask
+// copied to both lanes of the key, then the usual blend. A 16-byte register
+// holds a single key and SSE2 has no 64-bit compare, so that build runs the
+// branch-free scalar loop only. The normalization helpers pack common
+// composites into (hi, lo) in an order-preserving way.
+typedef struct {
+    uint64_t hi, lo;
+} key128_t;
+
+typedef uint64_t vk128_t __attribute__((vector_size(VEC_KEY_BYTES), aligned(sizeof(uint64_t))));
+typedef int64_t vk128_idx_t __attribute__((vector_size(VEC_KEY_BYTES)));
+
+static inline int key128_less(key128_t a, key128_t b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+static inline uint64_t key128_mix(key128_t k) { return key_mix64(k.hi ^ key_mix64(k.lo)); }
+
+// Two unsigned fields, major first
+static inline key128_t key128_from_u64_pair(uint64_t major, uint64_t minor) {
+    key128_t k = { major, minor };
+    return k;
+}
+
+// Signed fields: flipping the sign bit puts negative values first
+static inline key128_t key128_from_i64_pair(int64_t major, int64_t minor) {
+    return key128_from_u64_pair((uint64_t)major ^ ((uint64_t)1 << 63), (uint64_t)minor ^ ((uint64_t)1 << 63));
+}
+
+// (tenant, timestamp): tenant ID, then a signed time such as ns since the epoch
+static inline key128_t key128_from_tenant_time(uint32_t tenant, int64_t ts) {
+    return key128_from_u64_pair(tenant, (uint64_t)ts ^ ((uint64_t)1 << 63));
+}
+
+// UUID in its 16 wire bytes (RFC 4122 byte order): the key sorts like memcmp
+static inline key128_t key128_from_uuid(const unsigned char b[16]) {
+    key128_t k = { 0, 0 };
+    for (int i = 0; i < 8; i++) {
+        k.hi = k.hi << 8 | b[i];
+        k.lo = k.lo << 8 | b[8 + i];
+    }
+    return k;
+}
+
+static inline void compare_exchange_run_k128(key128_t *a, key128_t *b, size_t len, int dir) {
+    const size_t lanes = VEC_KEY_BYTES / sizeof(key128_t);
+    vk128_idx_t swap, hi;   // lane i <- i ^ 1 (lo onto hi) and i <- i & ~1 (hi to both)
+    for (size_t l = 0; l < 2 * lanes; l++) {
+        swap[l] = (int64_t)(l ^ 1);
+        hi[l] = (int64_t)(l & ~(size_t)1);
+    }
+    size_t t = 0;
+    STAT_PASS((size_t)(b - a) * sizeof(key128_t) / sizeof(int), 2 * len);
+    STAT_ADD(compares, len);
+    for (; lanes > 1 && t + lanes <= len; t += lanes) {
+        vk128_t x = *(vk128_t *)(a + t), y = *(vk128_t *)(b + t);
+        vk128_t gt = (vk128_t)(x > y), eq = (vk128_t)(x == y);
+        vk128_t m = __builtin_shuffle(gt | (eq & __builtin_shuffle(gt, swap)), hi);
+        vk128_t lo = (y & m) | (x & ~m), hv = (x & m) | (y & ~m);
+#ifdef SORT_STATS
+        for (size_t l = 0; l < lanes; l++)
+            STAT_ADD(swaps, dir ? key128_less(b[t + l], a[t + l]) : key128_less(a[t + l], b[t + l]));
+#endif
+        *(vk128_t *)(a + t) = dir ? lo : hv;
+        *(vk128_t *)(b + t) = dir ? hv : lo;
+    }
+    for (; t < len; t++) {                    // branch-free: swap under an all-ones mask
+        key128_t x = a[t], y = b[t];
+        uint64_t gt = (x.hi > y.hi) | ((x.hi == y.hi) & (x.lo > y.lo));
+        uint64_t lt = (x.hi < y.hi) | ((x.hi == y.hi) & (x.lo < y.lo));
+        uint64_t m = 0 - (dir ? gt : lt);
+        uint64_t dh = (x.hi ^ y.hi) & m, dl = (x.lo ^ y.lo) & m;
+        STAT_ADD(swaps, m & 1);
+        a[t].hi = x.hi ^ dh;
+        a[t].lo = x.lo ^ dl;
+        b[t].hi = y.hi ^ dh;
+        b[t].lo = y.lo ^ dl;
+    }
+}
+
+// Test input: random version-4 UUIDs, or (tenant, timestamp) pairs with 64
+// tenants and times on both sides of the epoch; a function of i alone
+static inline key128_t key128_input(size_t i, int pair) {
+    uint64_t r = key_mix64(2 * i), s = key_mix64(2 * i + 1);
+    if (pair) return key128_from_tenant_time((uint32_t)(r % 64), (int64_t)(s >> 20) - ((int64_t)1 << 43));
+    unsigned char b[16];
+    for (int x = 0; x < 8; x++) {
+        b[x] = (unsigned char)(r >> (56 - 8 * x));
+        b[8 + x] = (unsigned char)(s >> (56 - 8 * x));
+    }
+    b[6] = (b[6] & 0x0F) | 0x40;   // version 4
+    b[8] = (b[8] & 0x3F) | 0x80;   // RFC 4122 variant
+    return key128_from_uuid(b);
+}
+
+// Float keys (--keys=float|double)
+// IEEE bits become signed integer keys that compare like the values: negative
+// values get their magnitude bits inverted, so the integer engines sort floats
+// unchanged and a last pass maps the keys back. The key space is also rotated
+// down by the number of NaN patterns per sign, which wraps negative NaNs (put
+// below -inf by the inversion) around to the top. Every bit is kept, and the
+// order is fixed:  -inf < ... < -0.0 < +0.0 < ... < +inf < +NaN < -NaN, NaNs by payload.
+#define F32_NAN_CODES 0x7FFFFFu
+#define F64_NAN_CODES 0xFFFFFFFFFFFFFull
+
+static inline int f32_key(int bits) {
+    uint32_t b = (uint32_t)bits ^ ((uint32_t)(bits >> 31) & 0x7FFFFFFFu);
+    return (int)(b - F32_NAN_CODES);
+}
+
+static inline int f32_bits(int key) {
+    int b = (int)((uint32_t)key + F32_NAN_CODES);
+    return (int)((uint32_t)b ^ ((uint32_t)(b >> 31) & 0x7FFFFFFFu));
+}
+
+static inline int64_t f64_key(int64_t bits) {
+    uint64_t b = (uint64_t)bits ^ ((uint64_t)(bits >> 63) & 0x7FFFFFFFFFFFFFFFull);
+    return (int64_t)(b - F64_NAN_CODES);
+}
+
+static inline int64_t f64_bits(int64_t key) {
+    int64_t b = (int64_t)((uint64_t)key + F64_NAN_CODES);
+    return (int64_t)((uint64_t)b ^ ((uint64_t)(b >> 63) & 0x7FFFFFFFFFFFFFFFull));
+}
+
+// May x precede y in that order? Checked on the values, not the keys
+static inline int float_ordered(double x, double y) {
+    if (isnan(y)) return 1;
+    if (isnan(x)) return 0;
+    if (x == y) return signbit(x) || !signbit(y);   // -0.0 before +0.0
+    return x < y;
+}
+
+// Test input: values in [-1000, 1000], every 1000th one a special value
+static inline double float_input(size_t i) {
+    static const double special[6] = { NAN, -NAN, -0.0, 0.0, INFINITY, -INFINITY };
+    if (i % 1000 == 999) return special[(i / 1000) % 6];
+    return (rand() % 2000001 - 1000000) / 1000.0;
+}
+
+// Before and after the integer sort: keys for the n values plus padding in key
+// space, then the values back
+static inline void f32_to_keys(int arr[], size_t n, size_t m) {
+    PARALLEL_FOR
+    for (size_t i = 0; i < n; i++) arr[i] = f32_key(arr[i]);
+    for (size_t i = n; i < m; i++) arr[i] = INT_MAX;
+}
+
+static inline void f32_from_keys(int arr[], size_t n) {
+    PARALLEL_FOR
+    for (size_t i = 0; i < n; i++) arr[i] = f32_bits(arr[i]);
+}
+
+static inline void f64_to_keys(int64_t arr[], size_t n, size_t m) {
+    PARALLEL_FOR
+    for (size_t i = 0; i < n; i++) arr[i] = f64_key(arr[i]);
+    for (size_t i = n; i < m; i++) arr[i] = INT64_MAX;
+}
+
+static inline void f64_from_keys(int64_t arr[], size_t n) {
+    PARALLEL_FOR
+    for (size_t i = 0; i < n; i++) arr[i] = f64_bits(arr[i]);
+}
+
+// Padding for the narrow and 128-bit networks: the largest value of the type.
+// Genuine maxima sort alongside it, and the first n keys are the sorted input
+static inline void pad_u16(uint16_t arr[], size_t n, size_t m) {
+    for (size_t i = n; i < m; i++) arr[i] = UINT16_MAX;
+}
+
+static inline void pad_u8(uint8_t arr[], size_t n, size_t m) {
+    for (size_t i = n; i < m; i++) arr[i] = UINT8_MAX;
+}
+
+static inline void pad_k128(key128_t arr[], size_t n, size_t m) {
+    const key128_t pad = { UINT64_MAX, UINT64_MAX };
+    for (size_t i = n; i < m; i++) arr[i] = pad;
+}
+
+// Key types (--keys=int|float|double|u16|u8|uuid|pair) and the checked input
+// fill_keys writes the test input and returns its multiset hash; the verifiers
+// check the order of the output and hash it, so a matching hash means the sort
+// permuted its input. Int keys include their INT_MAX padding in both hashes;
+// the other types hash the n input keys only.
+enum { KEYS_INT, KEYS_FLOAT, KEYS_DOUBLE, KEYS_U16, KEYS_U8, KEYS_UUID, KEYS_PAIR };
+
+// Key type named s, -1 if there is none
+static inline int parse_key_type(const char *s) {
+    static const char *names[] = { "int", "float", "double", "u16", "u8", "uuid", "pair" };
+    for (int kt = KEYS_INT; kt <= KEYS_PAIR; kt++)
+        if (strcmp(s, names[kt]) == 0) return kt;
+    return -1;
+}
+
+static inline size_t key_width(int kt) {
+    return kt == KEYS_UUID || kt == KEYS_PAIR ? sizeof(key128_t) : kt == KEYS_DOUBLE ? sizeof(int64_t) :
+           kt == KEYS_U16 ? sizeof(uint16_t) : kt == KEYS_U8 ? sizeof(uint8_t) : sizeof(int);
+}
+
+// Fill arr (room for m keys of type kt) with n input keys; returns their hash
+static inline uint64_t fill_keys(int kt, void *arr, size_t n, size_t m) {
+    int *a = (int *)arr;
+    int64_t *a64 = (int64_t *)arr;
+    uint16_t *a16 = (uint16_t *)arr;
+    uint8_t *a8 = (uint8_t *)arr;
+    key128_t *a128 = (key128_t *)arr;
+    uint64_t hash = 0;
+    if (kt == KEYS_INT) {
+        for (size_t i = 0; i < n; i++) {
+            a[i] = rand() % 10000;
+            hash += key_mix(a[i]);
+        }
+        for (size_t i = n; i < m; i++) a[i] = INT_MAX;
+        hash += (uint64_t)(m - n) * key_mix(INT_MAX);
+    } else if (kt == KEYS_U16 || kt == KEYS_U8) {
+        // Same draw as int for u16 (14 bits); full byte range for u8
+        for (size_t i = 0; i < n; i++) {
+            int v = rand() % (kt == KEYS_U8 ? 256 : 10000);
+            if (kt == KEYS_U8) a8[i] = (uint8_t)v;
+            else a16[i] = (uint16_t)v;
+            hash += key_mix(v);
+        }
+    } else if (kt == KEYS_UUID || kt == KEYS_PAIR) {
+        for (size_t i = 0; i < n; i++) {
+            a128[i] = key128_input(i, kt == KEYS_PAIR);
+            hash += key128_mix(a128[i]);
+        }
+    } else {
+        // Float values go in as raw bits; padding is added in key space
+        for (size_t i = 0; i < n; i++) {
+            double v = float_input(i);
+            float f = (float)v;
+            if (kt == KEYS_DOUBLE) memcpy(&a64[i], &v, sizeof(v));
+            else memcpy(&a[i], &f, sizeof(f));
+            hash += kt == KEYS_DOUBLE ? key_mix64(a64[i]) : key_mix(a[i]);
+        }
+    }
+    return hash;
+}
+
+// The "Keys:" line for every type but int
+static inline void print_keys(int kt, const char *name, int counting) {
+    size_t width = key_width(kt);
+    if (kt == KEYS_FLOAT || kt == KEYS_DOUBLE) printf("Keys: %s (order-preserving integer keys)\n", name);
+    else if (kt == KEYS_U8 && counting) printf("Keys: u8 (counting sort)\n");
+    else if (width == sizeof(key128_t) && VEC_KEY_BYTES / width == 1)
+        printf("Keys: %s (128-bit, branch-free scalar)\n", name);
+    else if (width == sizeof(key128_t)) printf("Keys: %s (128-bit, %zu per vector)\n", name, VEC_KEY_BYTES / width);
+    else if (kt != KEYS_INT) printf("Keys: %s (%zu-lane vectors)\n", name, VEC_KEY_BYTES / width);
+}
+
+typedef struct {
+    int sorted;
+    uint64_t hash;
+} verify_t;
+
+// Order and hash of a[0..len), boundary with the previous element excluded
+static inline void verify_run(const int *a, size_t len, int *sorted, uint64_t *hash) {
+    int ok = 1;
+    uint64_t h = 0;
+    for (size_t i = 0; i < len; i++) {
+        h += key_mix(a[i]);
+        ok &= i == 0 || a[i-1] <= a[i];
+    }
+    *sorted = *sorted && ok;
+    *hash += h;
+}
+
+// Int keys: one read sweep over arr[0..n) in VERIFY_BLOCK runs
+#define VERIFY_BLOCK 4096
+
+static inline void verify_ints(const int arr[], size_t n, verify_t *v) {
+    int ok = 1;
+    uint64_t h = 0;
+    PARALLEL_FOR_VERIFY
+    for (size_t c = 0; c < n; c += VERIFY_BLOCK) {
+        size_t len = n - c < VERIFY_BLOCK ? n - c : VERIFY_BLOCK;
+        int run_ok = c == 0 || arr[c-1] <= arr[c];
+        verify_run(arr + c, len, &run_ok, &h);
+        ok = ok && run_ok;
+    }
+    v->sorted = ok;
+    v->hash = h;
+}
+
+// Value order and multiset hash of the raw bits (arr64 NULL: float32 in arr)
+static inline void verify_float(const int arr[], const int64_t arr64[], size_t n, verify_t *v) {
+    int ok = 1;
+    uint64_t h = 0;
+    PARALLEL_FOR_VERIFY
+    for (size_t i = 0; i < n; i++) {
+        double x, prev = 0.0;
+        if (arr64) {
+            memcpy(&x, &arr64[i], sizeof(x));
+            if (i > 0) memcpy(&prev, &arr64[i - 1], sizeof(prev));
+            h += key_mix64(arr64[i]);
+        } else {
+            float f, g = 0.0f;
+            memcpy(&f, &arr[i], sizeof(f));
+            if (i > 0) memcpy(&g, &arr[i - 1], sizeof(g));
+            x = f;
+            prev = g;
+            h += key_mix(arr[i]);
+        }
+        ok = ok && (i == 0 || float_ordered(prev, x));
+    }
+    v->sorted = ok;
+    v->hash = h;
+}
+
+// Narrow keys hash the values themselves, like int (padding excluded)
+static inline void verify_narrow(const uint16_t arr16[], const uint8_t arr8[], size_t n, verify_t *v) {
+    int ok = 1;
+    uint64_t h = 0;
+    PARALLEL_FOR_VERIFY
+    for (size_t i = 0; i < n; i++) {
+        int x = arr8 ? arr8[i] : arr16[i];
+        h += key_mix(x);
+        ok = ok && (i == 0 || (arr8 ? arr8[i - 1] : arr16[i - 1]) <= x);
+    }
+    v->sorted = ok;
+    v->hash = h;
+}
+
+static inline void verify_k128(const key128_t arr[], size_t n, verify_t *v) {
+    int ok = 1;
+    uint64_t h = 0;
+    PARALLEL_FOR_VERIFY
+    for (size_t i = 0; i < n; i++) {
+        h += key128_mix(arr[i]);
+        ok = ok && (i == 0 || !key128_less(arr[i], arr[i - 1]));
+    }
+    v->sorted = ok;
+    v->hash = h;
+}
+
+// Verify the output of fill_keys(kt, arr, n, m) after the sort
+static inline void verify_keys(int kt, const void *arr, size_t n, size_t m, verify_t *v) {
+    if (kt == KEYS_INT) verify_ints((const int *)arr, m, v);
+    else if (kt == KEYS_U16) verify_narrow((const uint16_t *)arr, NULL, n, v);
+    else if (kt == KEYS_U8) verify_narrow(NULL, (const uint8_t *)arr, n, v);
+    else if (kt == KEYS_UUID || kt == KEYS_PAIR) verify_k128((const key128_t *)arr, n, v);
+    else verify_float((const int *)arr, kt == KEYS_DOUBLE ? (const int64_t *)arr : NULL, n, v);
+}
+
+// Adaptive bitonic sorting (Bilardi-Nicolau)
+// The sequence lives in a bitonic tree: n - 1 nodes in in-order plus a spare
+// node holding the last element. A half-cleaner only ever exchanges a prefix or
+// a suffix of the two halves, so a merge finds that boundary with one
+// root-to-leaf walk and swaps whole subtrees instead of single elements, then
+// merges both halves the same way. That is O(n) per merge and O(n log n) for
+// the sort instead of O(n log^2 n). Keys carry their input position
+// (value << 32 | position) so equal values cannot break the prefix/suffix
+// property; child links are 32-bit, so the engines handle up to 2^32 elements.
+// The tree walk is pointer chasing, so it lost to the vectorized classic merge
+// at every size measured (2^14..2^24, 1.5x-3x slower) and needs 16 B/key of
+// tree scratch; --engine=auto never picks it. The drivers run the recursion
+// (sequentially or as tasks) and the pre-sort of the ADAPTIVE_BLOCK leaves.
+#define AB_NIL UINT32_MAX
+#define ADAPTIVE_BLOCK 4096
+
+typedef struct {
+    uint64_t *key;              // node i = in-order position i, spare = n - 1
+    uint32_t *left, *right;     // AB_NIL below the leaves
+} abtree_t;
+
+static inline void swap_u64(uint64_t *a, uint64_t *b) { uint64_t t = *a; *a = *b; *b = t; }
+static inline void swap_u32(uint32_t *a, uint32_t *b) { uint32_t t = *a; *a = *b; *b = t; }
+
+// Nodes in the subtree rooted at in-order position root
+static inline size_t ab_size(uint32_t root) { return 2 * (((size_t)root + 1) & ~(size_t)root) - 1; }
+
+// Tree buffers for n elements; 0 on success
+static inline int abtree_alloc(abtree_t *t, size_t n) {
+    t->key = (uint64_t *)aligned_buffer(sizeof(uint64_t) * n);
+    t->left = (uint32_t *)aligned_buffer(sizeof(uint32_t) * n);
+    t->right = (uint32_t *)aligned_buffer(sizeof(uint32_t) * n);
+    if (!t->key || !t->left || !t->right) {
+        free_aligned(t->key); free_aligned(t->left); free_aligned(t->right);
+        return -1;
+    }
+    STAT_ADD(scratch_bytes, (sizeof(uint64_t) + 2 * sizeof(uint32_t)) * n);
+    return 0;
+}
+
+static inline void abtree_free(abtree_t *t) {
+    free_aligned(t->key); free_aligned(t->left); free_aligned(t->right);
+}
+
+// Node i of the tree over arr[0..n), whose C-element blocks were sorted in the
+// directions the recursion expects (ascending iff (i / C) is even, or C == n)
+static inline void abtree_node(abtree_t *t, const int arr[], size_t i, size_t n, size_t C) {
+    size_t b = (i + 1) & ~i;           // subtree of i holds 2b - 1 nodes
+    size_t lo = i - i % C;
+    int up = C == n || (lo / C) % 2 == 0;
+    // Tie-break position runs with the block direction
+    uint32_t pos = (uint32_t)(up ? i : lo + (C - 1 - (i - lo)));
+    t->key[i] = ((uint64_t)((uint32_t)arr[i] ^ 0x80000000u) << 32) | pos;
+    t->left[i] = b > 1 ? (uint32_t)(i - b / 2) : AB_NIL;
+    t->right[i] = b > 1 ? (uint32_t)(i + b / 2) : AB_NIL;
+}
+
+// Value of a node key
+static inline int ab_value(uint64_t key) { return (int)((uint32_t)(key >> 32) ^ 0x80000000u); }
+
+// Half-cleaner of the bitonic sequence (subtree of root, then spare) in
+// direction up: afterwards each half of it is bitonic and the halves are
+// ordered; on a leaf it is the single compare-exchange with the spare
+static inline void adaptive_half_clean(abtree_t *t, uint32_t root, uint32_t spare, int up) {
+    int right_exchange = (t->key[root] > t->key[spare]) == up;
+    if (right_exchange) swap_u64(&t->key[root], &t->key[spare]);
+    STAT_ADD(compares, 1);
+    STAT_ADD(swaps, right_exchange);
+    uint32_t pl = t->left[root], pr = t->right[root];
+    while (pl != AB_NIL) {
+        int exchange = (t->key[pl] > t->key[pr]) == up;
+        STAT_ADD(compares, 1);
+        STAT_ADD(swaps, exchange);
+        if (exchange) swap_u64(&t->key[pl], &t->key[pr]);
+        if (right_exchange) {   // exchanged positions form a suffix
+            if (exchange) { swap_u32(&t->right[pl], &t->right[pr]); pl = t->left[pl]; pr = t->left[pr]; }
+            else { pl = t->right[pl]; pr = t->right[pr]; }
+        } else {                // exchanged positions form a prefix
+            if (exchange) { swap_u32(&t->left[pl], &t->left[pr]); pl = t->right[pl]; pr = t->right[pr]; }
+            else { pl = t->left[pl]; pr = t->left[pr]; }
+        }
+    }
+}
+
+// Alternative comparator networks: Batcher odd-even merge sort, Parberry pairwise
+// Both are data-oblivious like bitonic but use fewer comparators (63 vs 80 at
+// n = 16). A level is R runs of L ascending comparators (x + t, x + t + d) with
+// runs starting at x = x0 + m*S; odd-even comparators must stay inside one 2p
+// merge block (p2 = 2p). The OpenMP driver runs the levels over keys, the MPI
+// driver over ranks.
+enum { NET_BITONIC, NET_ODDEVEN, NET_PAIRWISE };
+
+typedef struct {
+    size_t x0, S, L, d, R;
+    size_t p2;         // merge block size for odd-even (0 = every run valid)
+} net_level_t;
+
+// Fill lv (room for lg(n) * (lg(n) + 1) / 2 levels) and return the level count
+static inline size_t network_levels(int net, size_t n, net_level_t *lv) {
+    size_t c = 0;
+    if (net == NET_ODDEVEN) {
+        for (size_t p = 1; p < n; p <<= 1) {
+            for (size_t k = p; k >= 1; k >>= 1) {
+                size_t x0 = k % p;
+                if (x0 + k >= n) continue;
+                lv[c++] = (net_level_t){ x0, 2 * k, k, k, (n - x0 - k + 2 * k - 1) / (2 * k), 2 * p };
+            }
+        }
+    } else {
+        size_t a = 1;
+        for (; a < n; a <<= 1)                   // sort pairs, quads, ... (ascending)
+            lv[c++] = (net_level_t){ 0, 2 * a, a, a, n / (2 * a), 0 };
+        size_t e = 1;
+        for (a /= 4; a > 0; a >>= 1, e = 2 * e + 1) {   // pairwise merge back down
+            for (size_t d = e; d > 0; d >>= 1) {
+                if ((d + 1) * a >= n) continue;
+                lv[c++] = (net_level_t){ a, 2 * a, a, d * a, (n - (d + 1) * a + 2 * a - 1) / (2 * a), 0 };
+            }
+        }
+    }
+    return c;
+}
+
+// Bitonic networks need 2^k keys: the smallest power of two >= n
+static inline size_t next_power_of_two(size_t n) {
+    if (n <= 1) return 1;
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+static inline double get_time(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;     // ns resolution for the latency benchmark
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+static inline int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Latency benchmark (--latency=REPS): p50/p99 over reps sorts of fresh random
+// n-key inputs, padded to m; sort(arr, m, ctx) is the driver's engine and label
+// (may be NULL) names it. Returns whether every output was sorted
+typedef void (*latency_sort_t)(int arr[], size_t m, const void *ctx);
+
+static inline int latency_bench(size_t n, size_t m, int reps, const char *label,
+                                latency_sort_t sort, const void *ctx) {
+    int *arr = (int *)aligned_buffer(sizeof(int) * m);
+    double *lat = (double *)malloc(sizeof(double) * reps);
+    if (!arr || !lat) {
+        perror("malloc");
+        exit(1);
+    }
+    int sorted = 1;
+    for (int r = 0; r < reps; r++) {
+        for (size_t i = 0; i < n; i++) arr[i] = rand() % 10000;
+        for (size_t i = n; i < m; i++) arr[i] = INT_MAX;
+        double t0 = get_time();
+        sort(arr, m, ctx);
+        lat[r] = get_time() - t0;
+        for (size_t i = 1; i < n; i++) sorted &= arr[i-1] <= arr[i];
+    }
+    qsort(lat, reps, sizeof(double), compare_double);
+    printf("Latency n=%zu", n);
+    if (label) printf(" (%s)", label);
+    printf(": p50 %.3f us, p99 %.3f us, max %.3f us over %d sorts\n",
+           lat[reps / 2] * 1e6, lat[(size_t)(reps - 1) * 99 / 100] * 1e6, lat[reps - 1] * 1e6, reps);
+    free(lat);
+    free_aligned(arr);
+    return sorted;
+}
+
+// Energy via RAPL powercap counters (--energy)
+// Every package zone intel-rapl:N and its "dram" subzone intel-rapl:N:M expose
+// energy_uj, a microjoule counter that wraps at max_energy_range_uj. A phase's
+// energy is the wrap-corrected difference of two reads. Core/uncore subzones
+// are skipped since the package already contains them. When the counters are
+// missing or unreadable (non-Intel, VMs, energy_uj root-only) the report says
+// so and the run goes on.
+#ifndef RAPL_ROOT
+#define RAPL_ROOT "/sys/class/powercap"
+#endif
+#define RAPL_MAX_ZONES 16
+
+typedef struct {
+    int count;
+    char path[RAPL_MAX_ZONES][128];   // .../energy_uj
+    int dram[RAPL_MAX_ZONES];         // 0 = package
+    unsigned long long range[RAPL_MAX_ZONES];
+} rapl_t;
+
+typedef struct {
+    unsigned long long uj[RAPL_MAX_ZONES];
+} rapl_sample_t;
+
+static inline int read_ull(const char *path, unsigned long long *v) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int ok = fscanf(f, "%llu", v) == 1;
+    fclose(f);
+    return ok;
+}
+
+// Find readable package and DRAM zones; returns how many
+static inline int rapl_open(rapl_t *r) {
+    r->count = 0;
+#ifdef __linux__
+    for (int pkg = 0; pkg < RAPL_MAX_ZONES; pkg++) {
+        for (int sub = -1; sub < RAPL_MAX_ZONES && r->count < RAPL_MAX_ZONES; sub++) {
+            char dir[96], file[128], name[32] = "";
+            if (sub < 0) snprintf(dir, sizeof(dir), RAPL_ROOT "/intel-rapl:%d", pkg);
+            else snprintf(dir, sizeof(dir), RAPL_ROOT "/intel-rapl:%d:%d", pkg, sub);
+            snprintf(file, sizeof(file), "%s/name", dir);
+            FILE *f = fopen(file, "r");
+            if (!f) {
+                if (sub < 0) return r->count;   // no more packages
+                break;                          // no more subzones
+            }
+            if (fscanf(f, "%31s", name) != 1) name[0] = '\0';
+            fclose(f);
+            int dram = strcmp(name, "dram") == 0;
+            if (sub >= 0 && !dram) continue;
+            unsigned long long v;
+            snprintf(r->path[r->count], sizeof(r->path[0]), "%s/energy_uj", dir);
+            if (!read_ull(r->path[r->count], &v)) continue;
+            snprintf(file, sizeof(file), "%s/max_energy_range_uj", dir);
+            if (!read_ull(file, &r->range[r->count])) r->range[r->count] = 0;
+            r->dram[r->count++] = dram;
+        }
+    }
+#endif
+    return r->count;
+}
+
+static inline void rapl_read(const rapl_t *r, rapl_sample_t *s) {
+    for (int i = 0; i < r->count; i++) {
+        if (!read_ull(r->path[i], &s->uj[i])) s->uj[i] = 0;
+    }
+}
+
+// Package and DRAM joules between two samples
+static inline void rapl_delta(const rapl_t *r, const rapl_sample_t *a, const rapl_sample_t *b,
+                              double *pkg_j, double *dram_j) {
+    *pkg_j = *dram_j = 0.0;
+    for (int i = 0; i < r->count; i++) {
+        unsigned long long d = b->uj[i] >= a->uj[i] ? b->uj[i] - a->uj[i]
+                                                    : b->uj[i] + r->range[i] - a->uj[i];
+        if (r->dram[i]) *dram_j += d / 1e6;
+        else *pkg_j += d / 1e6;
+    }
+}
+
+// One report line per phase: joules and joules per million input keys (n, not
+// the padded size); ranks > 0 for sums over MPI ranks
+static inline void rapl_print(const char *phase, int ranks, double pkg, double dram, size_t keys) {
+    printf("Energy %s", phase);
+    if (ranks > 0) printf(" (%d ranks)", ranks);
+    printf(": package %.3f J, DRAM %.3f J, %.3f J per million keys\n", pkg, dram, (pkg + dram) / (keys / 1e6));
+}
+
+// Report of a single process; nothing when no counters were found
+static inline void rapl_report(const rapl_t *r, const char *phase, const rapl_sample_t *a,
+                               const rapl_sample_t *b, size_t keys) {
+    if (r->count == 0) return;
+    double pkg, dram;
+    rapl_delta(r, a, b, &pkg, &dram);
+    rapl_print(phase, 0, pkg, dram, keys);
+}
+
+#endif
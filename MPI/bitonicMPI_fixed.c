@@ -6,75 +6,834 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <stdint.h>
 #include <mpi.h>
 
+#include "../Common/bitonic_common.h"
+
+// Statistics counters (-DSORT_STATS): one set per rank; merge-splits add their
+// comparisons and one sequential pass, and the buffers of the exchange count as
+// scratch bytes. Rank 0 prints the sum over ranks.
+#ifdef SORT_STATS
+static sort_stats_t sort_stats;
+
+static inline sort_stats_t *stat_self(void) { return &sort_stats; }
+
+void sort_stats_reset(void) { memset(&sort_stats, 0, sizeof(sort_stats)); }
+
+void sort_stats_get(sort_stats_t *out) { *out = sort_stats; }
+
+// Sum over the ranks of comm on rank 0 (max for max_depth)
+void sort_stats_reduce(sort_stats_t *out, MPI_Comm comm) {
+    sort_stats_t s = sort_stats;
+    MPI_Reduce(&s, out, (int)(sizeof(s) / sizeof(unsigned long long)), MPI_UNSIGNED_LONG_LONG,
+               MPI_SUM, 0, comm);
+    MPI_Reduce(&s.max_depth, &out->max_depth, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, comm);
+}
+#endif
+
 // Local bitonic sort functions
 static inline void swap_int(int *a, int *b) {
     int t = *a; *a = *b; *b = t;
 }
 
 // Compare and swap elements
-void bitonic_compare_and_swap(int arr[], int low, int k, int dir) {
-    for (int i = low; i < low + k; ++i) {
-        if (dir) { // ascending
-            if (arr[i] > arr[i + k]) swap_int(&arr[i], &arr[i + k]);
-        } else {   // descending
-            if (arr[i] < arr[i + k]) swap_int(&arr[i], &arr[i + k]);
-        }
-    }
+void bitonic_compare_and_swap(int arr[], size_t low, size_t k, int dir) {
+    compare_exchange_run(&arr[low], &arr[low + k], k, dir, 0);
 }
 
-void bitonic_merge_recursive(int arr[], int low, int cnt, int dir) {
+void bitonic_merge_recursive(int arr[], size_t low, size_t cnt, int dir) {
+    if (cnt > MULTI_LEVEL_MIN) {
+        // out of cache: three levels per sweep, then eight independent sub-merges
+        size_t q = cnt / 8;
+        compare_exchange_radix8(&arr[low], q, q, dir);
+        for (size_t r = 0; r < 8; r++) bitonic_merge_recursive(arr, low + r * q, q, dir);
+        return;
+    }
     if (cnt <= 1) return;
-    int k = cnt / 2;
+    size_t k = cnt / 2;
     bitonic_compare_and_swap(arr, low, k, dir);
     bitonic_merge_recursive(arr, low, k, dir);
     bitonic_merge_recursive(arr, low + k, k, dir);
 }
 
-void bitonic_sort_recursive(int arr[], int low, int cnt, int dir) {
+void bitonic_sort_recursive(int arr[], size_t low, size_t cnt, int dir) {
     if (cnt <= 1) return;
-    int k = cnt / 2;
+    size_t k = cnt / 2;
     bitonic_sort_recursive(arr, low, k, 1);
     bitonic_sort_recursive(arr, low + k, k, 0);
     bitonic_merge_recursive(arr, low, cnt, dir);
 }
 
 // Helper functions
-int next_power_of_two(int n) {
-    if (n <= 0) return 1;
-    int p = 1;
-    while (p < n) p <<= 1;
-    return p;
-}
-
 int is_power_of_two(int x) {
     return x > 0 && ( (x & (x - 1)) == 0 );
 }
 
-// Merge two sorted arrays and keep either smaller or larger half
-void merge_and_select(const int *a, const int *b, int *dst, int len, int keep_low) {
-    int *tmp = (int*)malloc(sizeof(int) * 2 * len);
-    if (!tmp) { perror("malloc tmp"); MPI_Abort(MPI_COMM_WORLD, 1); }
-    int i = 0, j = 0, t = 0;
-    while (i < len && j < len) {
-        if (a[i] <= b[j]) tmp[t++] = a[i++];
-        else tmp[t++] = b[j++];
+// Large-count helpers
+// MPI-3 counts are int, so blocks beyond INT_MAX elements are described by one
+// derived datatype: a contiguous run of BIG_CHUNK-element chunks plus a remainder.
+// With MPI-4 the _c calls take MPI_Count directly and no datatype is needed;
+// that branch is compiled out on MPI 3.1 (Open MPI 4.1) and has not been run.
+#define BIG_CHUNK ((size_t)1 << 20)
+
+// Build a datatype covering count elements of base (send with count 1); caller frees it
+void make_block_type(size_t count, MPI_Datatype base, MPI_Datatype *type) {
+    MPI_Datatype chunk, chunks;
+    MPI_Aint lb, extent;
+    size_t nchunks = count / BIG_CHUNK;
+    size_t rem = count % BIG_CHUNK;
+
+    MPI_Type_get_extent(base, &lb, &extent);
+    MPI_Type_contiguous((int)BIG_CHUNK, base, &chunk);
+    MPI_Type_contiguous((int)nchunks, chunk, &chunks);
+
+    int lengths[2] = { 1, (int)rem };
+    MPI_Aint displs[2] = { 0, (MPI_Aint)(nchunks * BIG_CHUNK) * extent };
+    MPI_Datatype types[2] = { chunks, base };
+    MPI_Type_create_struct(rem ? 2 : 1, lengths, displs, types, type);
+    MPI_Type_commit(type);
+
+    MPI_Type_free(&chunks);
+    MPI_Type_free(&chunk);
+}
+
+// Pick (count, datatype) for a block of count elements; returns 1 if type must be freed
+int block_args(size_t count, MPI_Datatype base, int *mpi_count, MPI_Datatype *type) {
+    if (count <= (size_t)INT_MAX) {
+        *mpi_count = (int)count;
+        *type = base;
+        return 0;
     }
-    while (i < len) tmp[t++] = a[i++];
-    while (j < len) tmp[t++] = b[j++];
+    make_block_type(count, base, type);
+    *mpi_count = 1;
+    return 1;
+}
+
+void scatter_block(const void *sendbuf, void *recvbuf, size_t count, MPI_Datatype base,
+                   int root, MPI_Comm comm) {
+#if MPI_VERSION >= 4
+    MPI_Scatter_c(sendbuf, (MPI_Count)count, base, recvbuf, (MPI_Count)count, base, root, comm);
+#else
+    int c; MPI_Datatype t;
+    int owned = block_args(count, base, &c, &t);
+    MPI_Scatter(sendbuf, c, t, recvbuf, c, t, root, comm);
+    if (owned) MPI_Type_free(&t);
+#endif
+}
+
+void gather_block(const void *sendbuf, void *recvbuf, size_t count, MPI_Datatype base,
+                  int root, MPI_Comm comm) {
+#if MPI_VERSION >= 4
+    MPI_Gather_c(sendbuf, (MPI_Count)count, base, recvbuf, (MPI_Count)count, base, root, comm);
+#else
+    int c; MPI_Datatype t;
+    int owned = block_args(count, base, &c, &t);
+    MPI_Gather(sendbuf, c, t, recvbuf, c, t, root, comm);
+    if (owned) MPI_Type_free(&t);
+#endif
+}
+
+void sendrecv_block(const void *sendbuf, void *recvbuf, size_t count, MPI_Datatype base,
+                    int partner, MPI_Comm comm) {
+#if MPI_VERSION >= 4
+    MPI_Sendrecv_c(sendbuf, (MPI_Count)count, base, partner, 0,
+                   recvbuf, (MPI_Count)count, base, partner, 0,
+                   comm, MPI_STATUS_IGNORE);
+#else
+    int c; MPI_Datatype t;
+    int owned = block_args(count, base, &c, &t);
+    MPI_Sendrecv(sendbuf, c, t, partner, 0,
+                 recvbuf, c, t, partner, 0,
+                 comm, MPI_STATUS_IGNORE);
+    if (owned) MPI_Type_free(&t);
+#endif
+}
+
+void send_block(const void *buf, size_t count, MPI_Datatype base, int dest, MPI_Comm comm) {
+#if MPI_VERSION >= 4
+    MPI_Send_c(buf, (MPI_Count)count, base, dest, 0, comm);
+#else
+    int c; MPI_Datatype t;
+    int owned = block_args(count, base, &c, &t);
+    MPI_Send(buf, c, t, dest, 0, comm);
+    if (owned) MPI_Type_free(&t);
+#endif
+}
+
+void recv_block(void *buf, size_t count, MPI_Datatype base, int src, MPI_Comm comm) {
+#if MPI_VERSION >= 4
+    MPI_Recv_c(buf, (MPI_Count)count, base, src, 0, comm, MPI_STATUS_IGNORE);
+#else
+    int c; MPI_Datatype t;
+    int owned = block_args(count, base, &c, &t);
+    MPI_Recv(buf, c, t, src, 0, comm, MPI_STATUS_IGNORE);
+    if (owned) MPI_Type_free(&t);
+#endif
+}
+
+// Merge two sorted arrays and keep either smaller or larger half. Only the kept
+// half is produced, straight into dst (front-to-back for low, back-to-front for
+// high), so a compare-split needs no scratch beyond the caller's dst block.
+void merge_and_select(const int *a, const int *b, int *dst, size_t len, int keep_low) {
+    STAT_ADD(compares, len);   // one comparison per kept key
+    STAT_PASS(1, 2 * len);
     if (keep_low) {
-        memcpy(dst, tmp, sizeof(int) * len);
+        size_t i = 0, j = 0;
+        for (size_t t = 0; t < len; ++t)
+            dst[t] = j >= len || (i < len && a[i] <= b[j]) ? a[i++] : b[j++];
     } else {
-        memcpy(dst, tmp + len, sizeof(int) * len);
+        size_t i = len, j = len; // one past the next candidate
+        for (size_t t = len; t-- > 0; )
+            dst[t] = j == 0 || (i > 0 && a[i - 1] > b[j - 1]) ? a[--i] : b[--j];
     }
-    free(tmp);
 }
 
-// Check if array is sorted
-int verify_sorted(const int *global, int n) {
-    for (int i = 1; i < n; ++i) if (global[i-1] > global[i]) return 0;
-    return 1;
+// Key-value records (SoA layout)
+// Keys stay in an int array; record i owns payload bytes [i*W, (i+1)*W) of a
+// parallel payload array, with W = 4, 8 or 16. One set of kernels is generated
+// per width: payloads load as NW words of type PT and move with the key under
+// the same all-ones/all-zeros mask, so the inner loops have no branches and no
+// width switch. The _kv entry points pick the width once per call. The
+// key-only functions above are left untouched, so the plain path pays nothing
+// for record support.
+#define PAYLOAD_SKEW (33 * CACHE_LINE)   // payload offset from key alignment, in bytes
+
+#define DEFINE_KV_KERNELS(W, PT, NW)                                                        \
+static inline void compare_exchange_run_kv##W(int *ka, int *kb, unsigned char *pa,          \
+                                              unsigned char *pb, size_t len, int dir) {     \
+    for (size_t i = 0; i < len; ++i) {                                                      \
+        int x = ka[i], y = kb[i];                                                           \
+        int s = dir ? x > y : x < y;                                                        \
+        int km = -s;                                                                        \
+        PT m = (PT)0 - (PT)s, u[NW], v[NW];                                                 \
+        STAT_ADD(swaps, s);                                                                 \
+        ka[i] = (x & ~km) | (y & km);                                                       \
+        kb[i] = (y & ~km) | (x & km);                                                       \
+        memcpy(u, pa + i * W, W);                                                           \
+        memcpy(v, pb + i * W, W);                                                           \
+        for (int q = 0; q < NW; ++q) {                                                      \
+            PT t = (u[q] ^ v[q]) & m;                                                       \
+            u[q] ^= t;                                                                      \
+            v[q] ^= t;                                                                      \
+        }                                                                                   \
+        memcpy(pa + i * W, u, W);                                                           \
+        memcpy(pb + i * W, v, W);                                                           \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+void bitonic_merge_recursive_kv##W(int keys[], unsigned char payload[],                     \
+                                   size_t low, size_t cnt, int dir) {                       \
+    if (cnt <= 1) return;                                                                   \
+    size_t k = cnt / 2;                                                                     \
+    STAT_ADD(compares, k);                                                                  \
+    STAT_PASS(k, 2 * k);                                                                    \
+    compare_exchange_run_kv##W(keys + low, keys + low + k, payload + low * W,               \
+                               payload + (low + k) * W, k, dir);                            \
+    bitonic_merge_recursive_kv##W(keys, payload, low, k, dir);                              \
+    bitonic_merge_recursive_kv##W(keys, payload, low + k, k, dir);                          \
+}                                                                                           \
+                                                                                            \
+void bitonic_sort_recursive_kv##W(int keys[], unsigned char payload[],                      \
+                                  size_t low, size_t cnt, int dir) {                        \
+    if (cnt <= 1) return;                                                                   \
+    size_t k = cnt / 2;                                                                     \
+    bitonic_sort_recursive_kv##W(keys, payload, low, k, 1);                                 \
+    bitonic_sort_recursive_kv##W(keys, payload, low + k, k, 0);                             \
+    bitonic_merge_recursive_kv##W(keys, payload, low, cnt, dir);                            \
+}                                                                                           \
+                                                                                            \
+/* Indices are clamped so the losing side is never read past its end */                    \
+void merge_and_select_kv##W(const int *ka, const unsigned char *pa,                         \
+                            const int *kb, const unsigned char *pb,                         \
+                            int *kdst, unsigned char *pdst, size_t len, int keep_low) {     \
+    if (keep_low) {                                                                         \
+        size_t i = 0, j = 0;                                                                \
+        for (size_t t = 0; t < len; ++t) {                                                  \
+            size_t ic = i < len ? i : len - 1, jc = j < len ? j : len - 1;                  \
+            int take_a = (j >= len) | ((i < len) & (ka[ic] <= kb[jc]));                     \
+            kdst[t] = take_a ? ka[ic] : kb[jc];                                             \
+            memcpy(pdst + t * W, take_a ? pa + ic * W : pb + jc * W, W);                    \
+            i += take_a;                                                                    \
+            j += !take_a;                                                                   \
+        }                                                                                   \
+    } else {                                                                                \
+        size_t i = len, j = len; /* one past the next candidate */                          \
+        for (size_t t = len; t-- > 0; ) {                                                   \
+            size_t ic = i > 0 ? i - 1 : 0, jc = j > 0 ? j - 1 : 0;                          \
+            int take_a = (j == 0) | ((i > 0) & (ka[ic] > kb[jc]));                          \
+            kdst[t] = take_a ? ka[ic] : kb[jc];                                             \
+            memcpy(pdst + t * W, take_a ? pa + ic * W : pb + jc * W, W);                    \
+            i -= take_a;                                                                    \
+            j -= !take_a;                                                                   \
+        }                                                                                   \
+    }                                                                                       \
+}
+
+DEFINE_KV_KERNELS(4, uint32_t, 1)
+DEFINE_KV_KERNELS(8, uint64_t, 1)
+DEFINE_KV_KERNELS(16, uint64_t, 2)
+
+void bitonic_sort_recursive_kv(int keys[], unsigned char payload[], size_t w,
+                               size_t low, size_t cnt, int dir) {
+    switch (w) {
+    case 4:  bitonic_sort_recursive_kv4(keys, payload, low, cnt, dir);  break;
+    case 8:  bitonic_sort_recursive_kv8(keys, payload, low, cnt, dir);  break;
+    default: bitonic_sort_recursive_kv16(keys, payload, low, cnt, dir); break;
+    }
+}
+
+// Record version of merge_and_select: payloads follow their keys
+void merge_and_select_kv(const int *ka, const unsigned char *pa,
+                         const int *kb, const unsigned char *pb,
+                         int *kdst, unsigned char *pdst, size_t w,
+                         size_t len, int keep_low) {
+    STAT_ADD(compares, len);   // one comparison per kept record
+    STAT_PASS(1, 2 * len);
+    switch (w) {
+    case 4:  merge_and_select_kv4(ka, pa, kb, pb, kdst, pdst, len, keep_low);  break;
+    case 8:  merge_and_select_kv8(ka, pa, kb, pb, kdst, pdst, len, keep_low);  break;
+    default: merge_and_select_kv16(ka, pa, kb, pb, kdst, pdst, len, keep_low); break;
+    }
+}
+
+// Row ID stored in the first 4 (w == 4) or 8 bytes of a payload
+static inline size_t payload_row_id(const unsigned char *p, size_t w) {
+    if (w == 4) { unsigned int r; memcpy(&r, p, 4); return r; }
+    unsigned long long r; memcpy(&r, p, 8); return (size_t)r;
+}
+
+static inline void set_payload_row_id(unsigned char *p, size_t w, size_t row) {
+    memset(p, 0, w);
+    if (w == 4) { unsigned int r = (unsigned int)row; memcpy(p, &r, 4); }
+    else { unsigned long long r = row; memcpy(p, &r, 8); }
+}
+
+// Distributed selection on locally sorted blocks (no global sort)
+// Each round every rank offers the median of its active window weighted by the
+// window size; the weighted median of those becomes the pivot, one Allreduce
+// counts keys below / up to it, and every window shrinks to the side holding
+// rank k. At least a quarter of the active keys drop out per round, so rank k
+// is found in O(log N) rounds of P-sized Allgathers and 2-word Allreduces.
+typedef struct { long long value; long long weight; } weighted_t;
+
+static int cmp_weighted(const void *x, const void *y) {
+    long long a = ((const weighted_t*)x)->value, b = ((const weighted_t*)y)->value;
+    return (a > b) - (a < b);
+}
+
+// First index in [lo, hi) with arr[i] >= v (or > v when inclusive)
+static size_t bound_search(const int *arr, size_t lo, size_t hi, int v, int inclusive) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (arr[mid] < v || (inclusive && arr[mid] == v)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Return the key of global rank k (0-based) across all ranks' sorted blocks
+int distributed_select(const int *local, size_t local_size, unsigned long long k,
+                       MPI_Comm comm, int *rounds) {
+    int size;
+    MPI_Comm_size(comm, &size);
+    weighted_t *cand = (weighted_t*)malloc(sizeof(weighted_t) * (size_t)size);
+    if (!cand) { perror("malloc cand"); MPI_Abort(comm, 1); }
+
+    size_t lo = 0, hi = local_size; // active window in the local block
+    int result = INT_MAX;
+    *rounds = 0;
+    for (;;) {
+        ++*rounds;
+        weighted_t mine = { 0, (long long)(hi - lo) };
+        if (hi > lo) mine.value = local[lo + (hi - lo) / 2];
+        MPI_Allgather(&mine, 2, MPI_LONG_LONG, cand, 2, MPI_LONG_LONG, comm);
+
+        // Weighted median of the per-rank medians (same result on every rank)
+        long long total = 0;
+        int m = 0;
+        for (int r = 0; r < size; ++r) {
+            if (cand[r].weight > 0) { total += cand[r].weight; cand[m++] = cand[r]; }
+        }
+        qsort(cand, (size_t)m, sizeof(weighted_t), cmp_weighted);
+        long long acc = 0;
+        int pivot = (int)cand[m - 1].value;
+        for (int r = 0; r < m; ++r) {
+            acc += cand[r].weight;
+            if (2 * acc >= total) { pivot = (int)cand[r].value; break; }
+        }
+
+        size_t lt = bound_search(local, lo, hi, pivot, 0);
+        size_t le = bound_search(local, lt, hi, pivot, 1);
+        unsigned long long counts[2] = { lt - lo, le - lo }, global_counts[2];
+        MPI_Allreduce(counts, global_counts, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+
+        if (k < global_counts[0]) {
+            hi = lt;                      // answer is below the pivot
+        } else if (k < global_counts[1]) {
+            result = pivot;               // pivot itself has rank k
+            break;
+        } else {
+            k -= global_counts[1];        // answer is above the pivot
+            lo = le;
+        }
+    }
+    free(cand);
+    return result;
+}
+
+// Rank-level comparator networks
+// The exchange loop only needs, per step, a partner and which half to keep, so
+// any sorting network over the P ranks can drive it: a comparator (a, b) becomes
+// a compare-split where a keeps the low half and b the high half. Besides the
+// bitonic network, the odd-even and pairwise levels of Common/bitonic_common.h
+// are available; both need fewer compare-splits.
+
+// Is x the low end of a comparator in level v (over n slots)?
+static int network_low_end(const net_level_t *v, size_t x, size_t n) {
+    if (x < v->x0 || x + v->d >= n) return 0;
+    size_t off = x - v->x0;
+    if (off / v->S >= v->R || off % v->S >= v->L) return 0;
+    return !v->p2 || x / v->p2 == (x + v->d) / v->p2;
+}
+
+typedef struct { int partner; int keep_low; } split_step_t;
+
+// This rank's compare-split schedule (partner -1 = idle step); returns step count
+int network_schedule(int net, int rank, int size, split_step_t *steps) {
+    int c = 0;
+    if (net == NET_BITONIC) {
+        for (int k = 2; k <= size; k <<= 1) {
+            for (int j = k >> 1; j > 0; j >>= 1) {
+                // Determine sort direction based on position in bitonic network
+                int ascending_block = ((rank & k) == 0);
+                int lower_partner = ((rank & j) == 0);
+                steps[c].partner = rank ^ j; // XOR to find communication partner
+                steps[c++].keep_low = ascending_block ? lower_partner : (1 - lower_partner);
+            }
+        }
+        return c;
+    }
+    net_level_t lv[64 * 65 / 2];
+    size_t levels = network_levels(net, (size_t)size, lv);
+    for (size_t l = 0; l < levels; l++) {
+        size_t r = (size_t)rank, d = lv[l].d;
+        steps[c].partner = -1;
+        if (network_low_end(&lv[l], r, (size_t)size)) {
+            steps[c].partner = (int)(r + d); steps[c].keep_low = 1;
+        } else if (r >= d && network_low_end(&lv[l], r - d, (size_t)size)) {
+            steps[c].partner = (int)(r - d); steps[c].keep_low = 0;
+        }
+        c++;
+    }
+    return c;
+}
+
+// Distributed top-k
+// Local step: sort blocks of K (power of two >= k) in alternating directions,
+// then repeatedly fold block pairs with elementwise min - an ascending and a
+// descending block give a bitonic block holding the K smallest of both - and
+// re-sort that with one bitonic merge. Costs O(n log^2 K) instead of a full sort.
+// Result: the K smallest keys, ascending, in arr[0..K).
+void local_topk(int arr[], size_t n, size_t K) {
+    size_t blocks = n / K;
+    for (size_t b = 0; b < blocks; ++b)
+        bitonic_sort_recursive(arr, b * K, K, (b % 2) == 0);
+
+    while (blocks > 1) {
+        size_t half = blocks / 2;
+        for (size_t b = 0; b < half; ++b) {
+            int *lo = arr + 2 * b * K;          // ascending block
+            const int *hi = lo + K;             // descending block
+            for (size_t t = 0; t < K; ++t) if (hi[t] < lo[t]) lo[t] = hi[t];
+            int dir = (half == 1) || (b % 2) == 0;
+            bitonic_merge_recursive(lo, 0, K, dir);
+            if (b) memmove(arr + b * K, lo, sizeof(int) * K);
+        }
+        blocks = half;
+    }
+}
+
+// Tree reduction over the rank ^ j partner pattern: at level j the upper rank of
+// each pair sends its K keys and drops out, the lower one merges and keeps the K
+// smallest. After log P levels rank 0 holds the global top-K in buf.
+void reduce_topk(int *buf, int *recv_buf, int *tmp, size_t K, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    for (int j = 1; j < size; j <<= 1) {
+        int partner = rank ^ j;
+        if (rank & j) {                       // upper rank: hand over and drop out
+            send_block(buf, K, MPI_INT, partner, comm);
+            break;
+        }
+        recv_block(recv_buf, K, MPI_INT, partner, comm);
+        merge_and_select(buf, recv_buf, tmp, K, 1);
+        memcpy(buf, tmp, sizeof(int) * K);
+    }
+}
+
+// Order-independent multiset hash: sum (mod 2^64) of a 64-bit mix of every
+// key, so blocks can be hashed anywhere and the per-rank sums simply added.
+uint64_t multiset_hash(const int *a, size_t n) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < n; ++i) h += key_mix(a[i]);
+    return h;
+}
+
+typedef struct {
+    int sorted;
+    uint64_t in_hash, out_hash;   // summed over all ranks
+} dist_verify_t;
+
+// Distributed verification: every rank checks order and hashes its own block in
+// one pass, compares its last key with the next rank's first, and the hashes
+// meet in one allreduce, so nothing is gathered and the cost falls with P
+void verify_distributed(const int *local, size_t local_size, uint64_t local_in_hash,
+                        dist_verify_t *v, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int ok = 1;
+    uint64_t h[2] = { local_in_hash, 0 };
+    for (size_t i = 0; i < local_size; ++i) {
+        h[1] += key_mix(local[i]);
+        ok &= i == 0 || local[i-1] <= local[i];
+    }
+    int next_first = INT_MAX;
+    MPI_Sendrecv(&local[0], 1, MPI_INT, rank > 0 ? rank - 1 : MPI_PROC_NULL, 0,
+                 &next_first, 1, MPI_INT, rank < size - 1 ? rank + 1 : MPI_PROC_NULL, 0,
+                 comm, MPI_STATUS_IGNORE);
+    ok &= local[local_size - 1] <= next_first;
+
+    uint64_t sum[2];
+    MPI_Allreduce(&ok, &v->sorted, 1, MPI_INT, MPI_LAND, comm);
+    MPI_Allreduce(h, sum, 2, MPI_UINT64_T, MPI_SUM, comm);
+    v->in_hash = sum[0];
+    v->out_hash = sum[1];
+}
+
+// 128-bit keys (--keys=uuid|pair): local network over compare_exchange_run_k128
+void bitonic_merge_recursive_k128(key128_t arr[], size_t low, size_t cnt, int dir) {
+    if (cnt <= 1) return;
+    size_t k = cnt / 2;
+    compare_exchange_run_k128(&arr[low], &arr[low + k], k, dir);
+    bitonic_merge_recursive_k128(arr, low, k, dir);
+    bitonic_merge_recursive_k128(arr, low + k, k, dir);
+}
+
+void bitonic_sort_recursive_k128(key128_t arr[], size_t low, size_t cnt, int dir) {
+    if (cnt <= 1) return;
+    size_t k = cnt / 2;
+    bitonic_sort_recursive_k128(arr, low, k, 1);
+    bitonic_sort_recursive_k128(arr, low + k, k, 0);
+    bitonic_merge_recursive_k128(arr, low, cnt, dir);
+}
+
+// 128-bit version of merge_and_select
+void merge_and_select_k128(const key128_t *a, const key128_t *b, key128_t *dst, size_t len, int keep_low) {
+    STAT_ADD(compares, len);
+    STAT_PASS(1, 2 * len);
+    if (keep_low) {
+        size_t i = 0, j = 0;
+        for (size_t t = 0; t < len; ++t)
+            dst[t] = j >= len || (i < len && !key128_less(b[j], a[i])) ? a[i++] : b[j++];
+    } else {
+        size_t i = len, j = len; // one past the next candidate
+        for (size_t t = len; t-- > 0; )
+            dst[t] = j == 0 || (i > 0 && key128_less(b[j - 1], a[i - 1])) ? a[--i] : b[--j];
+    }
+}
+
+// verify_distributed for 128-bit keys (key_type is the committed 16-byte type)
+void verify_distributed_k128(const key128_t *local, size_t local_size, uint64_t local_in_hash,
+                             MPI_Datatype key_type, dist_verify_t *v, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int ok = 1;
+    uint64_t h[2] = { local_in_hash, 0 };
+    for (size_t i = 0; i < local_size; ++i) {
+        h[1] += key128_mix(local[i]);
+        ok &= i == 0 || !key128_less(local[i], local[i-1]);
+    }
+    key128_t next_first = { UINT64_MAX, UINT64_MAX };
+    MPI_Sendrecv(&local[0], 1, key_type, rank > 0 ? rank - 1 : MPI_PROC_NULL, 0,
+                 &next_first, 1, key_type, rank < size - 1 ? rank + 1 : MPI_PROC_NULL, 0,
+                 comm, MPI_STATUS_IGNORE);
+    ok &= !key128_less(next_first, local[local_size - 1]);
+
+    uint64_t sum[2];
+    MPI_Allreduce(&ok, &v->sorted, 1, MPI_INT, MPI_LAND, comm);
+    MPI_Allreduce(h, sum, 2, MPI_UINT64_T, MPI_SUM, comm);
+    v->in_hash = sum[0];
+    v->out_hash = sum[1];
+}
+
+// Full sort of 128-bit keys: the key-only pipeline of main (scatter, local
+// sort, one compare-split per network step, gather, distributed verify) with
+// every key one committed 16-byte datatype; all-ones padding sorts last
+int sort_k128_distributed(size_t n, size_t N, int net, const char *network, int pair, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    size_t local_size = N / (size_t)size;
+    const key128_t pad = { UINT64_MAX, UINT64_MAX };
+
+    MPI_Datatype key_type;
+    MPI_Type_contiguous(2, MPI_UINT64_T, &key_type);
+    MPI_Type_commit(&key_type);
+
+    key128_t *global_arr = NULL;
+    if (rank == 0) {
+        global_arr = (key128_t*)aligned_buffer(sizeof(key128_t) * N);
+        if (!global_arr) { perror("malloc global_arr"); MPI_Abort(comm, 1); }
+        for (size_t i = 0; i < n; ++i) global_arr[i] = key128_input(i, pair);
+        for (size_t i = n; i < N; ++i) global_arr[i] = pad;
+    }
+    key128_t *local = (key128_t*)aligned_buffer(sizeof(key128_t) * local_size);
+    key128_t *recv_buf = (key128_t*)aligned_buffer(sizeof(key128_t) * local_size);
+    key128_t *new_local = (key128_t*)aligned_buffer(sizeof(key128_t) * local_size);
+    if (!local || !recv_buf || !new_local) { perror("malloc buffers"); MPI_Abort(comm, 1); }
+#ifdef SORT_STATS
+    sort_stats_reset();
+    STAT_ADD(scratch_bytes, 2 * sizeof(key128_t) * local_size);
+#endif
+
+    MPI_Barrier(comm); // sync before timing
+    double t0 = MPI_Wtime();
+    scatter_block(global_arr, local, local_size, key_type, 0, comm);
+    uint64_t local_in_hash = 0;
+    for (size_t i = 0; i < local_size; ++i) local_in_hash += key128_mix(local[i]);
+    bitonic_sort_recursive_k128(local, 0, local_size, 1);
+
+    split_step_t steps[64 * 65 / 2];
+    int nsteps = network_schedule(net, rank, size, steps);
+    long long splits = 0;
+    for (int st = 0; st < nsteps; st++) {
+        if (steps[st].partner >= 0) {
+            splits++;
+            sendrecv_block(local, recv_buf, local_size, key_type, steps[st].partner, comm);
+            merge_and_select_k128(local, recv_buf, new_local, local_size, steps[st].keep_low);
+            key128_t *kt = local; local = new_local; new_local = kt;
+        }
+        MPI_Barrier(comm); // sync after each merge step
+    }
+    long long total_splits = 0;
+    MPI_Reduce(&splits, &total_splits, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+    gather_block(local, global_arr, local_size, key_type, 0, comm);
+    MPI_Barrier(comm);
+    double t1 = MPI_Wtime();
+
+    dist_verify_t v;
+    verify_distributed_k128(local, local_size, local_in_hash, key_type, &v, comm);
+    double t2 = MPI_Wtime();
+
+    if (rank == 0) {
+        printf("Elapsed time: %.6f s\n", t1 - t0);
+        printf("Network: %s, %d steps, %lld compare-splits\n", network, nsteps, total_splits / 2);
+        printf("Verify: %.6f s\n", t2 - t1);
+        printf("Result: %s\n", v.sorted ? "SORTED" : "NOT SORTED");
+        printf("Checksum: %s (%016llx)\n", v.out_hash == v.in_hash ? "MATCH" : "MISMATCH",
+               (unsigned long long)v.out_hash);
+        free_aligned(global_arr);
+    }
+#ifdef SORT_STATS
+    sort_stats_t stats;
+    sort_stats_reduce(&stats, comm);
+    if (rank == 0) sort_stats_print(&stats, N, size);
+#endif
+
+    free_aligned(local);
+    free_aligned(recv_buf);
+    free_aligned(new_local);
+    MPI_Type_free(&key_type);
+    return v.sorted && v.out_hash == v.in_hash ? 0 : 1;
+}
+
+// Kernel microbenchmarks (--microbench[=FILE], JSON, rank 0 only)
+// merge_and_select is the local half of every compare-split; it is timed with
+// fixed sorted inputs, so each call does the same merge. Each result is the
+// median of MB_SAMPLES samples of at least MB_MIN_SECS.
+#define MB_SAMPLES 7
+#define MB_MIN_SECS 0.002
+
+typedef struct {
+    int *a, *b, *dst;
+    unsigned char *pa, *pb, *pdst;
+    size_t len, w;
+    int keep_low;
+} mb_ctx_t;
+
+typedef void (*mb_fn_t)(mb_ctx_t *);
+
+// Median seconds per call of fn
+static double mb_time(mb_fn_t fn, mb_ctx_t *c) {
+    size_t calls = 1;
+    for (;;) {
+        double t0 = MPI_Wtime();
+        for (size_t i = 0; i < calls; ++i) fn(c);
+        if (MPI_Wtime() - t0 >= MB_MIN_SECS) break;
+        calls *= 2;
+    }
+    double s[MB_SAMPLES];
+    for (int k = 0; k < MB_SAMPLES; ++k) {
+        double t0 = MPI_Wtime();
+        for (size_t i = 0; i < calls; ++i) fn(c);
+        s[k] = (MPI_Wtime() - t0) / calls;
+    }
+    qsort(s, MB_SAMPLES, sizeof(double), compare_double);
+    return s[MB_SAMPLES / 2];
+}
+
+static void mb_merge(mb_ctx_t *c) { merge_and_select(c->a, c->b, c->dst, c->len, c->keep_low); }
+
+static void mb_merge_kv(mb_ctx_t *c) {
+    merge_and_select_kv(c->a, c->pa, c->b, c->pb, c->dst, c->pdst, c->w, c->len, c->keep_low);
+}
+
+// Run every case and write one JSON document to path (stdout when NULL)
+int microbench(const char *path) {
+    const size_t max_len = (size_t)1 << 22, max_w = 16;
+    int *keys = (int*)aligned_buffer(sizeof(int) * 3 * max_len);
+    unsigned char *pay = (unsigned char*)aligned_buffer(max_w * 3 * max_len);
+    if (!keys || !pay) { perror("malloc microbench"); return 1; }
+    memset(pay, 0, max_w * 3 * max_len);
+    FILE *f = path ? fopen(path, "w") : stdout;
+    if (!f) { perror(path); free_aligned(keys); free_aligned(pay); return 1; }
+    fprintf(f, "{\n  \"suite\": \"bitonicMPI_fixed\",\n  \"results\": [");
+    int first = 1;
+    for (size_t len = (size_t)1 << 10; len <= max_len; len <<= 2) {
+        // Two sorted runs with interleaved keys, as after a local sort
+        for (size_t i = 0; i < len; ++i) { keys[i] = (int)(2 * i); keys[len + i] = (int)(2 * i + 1); }
+        for (int keep_low = 1; keep_low >= 0; --keep_low) {
+            for (size_t w = 0; w <= max_w; w = w ? 2 * w : 4) {
+                if (w == 4) continue;   // 8 and 16 cover the record copies
+                mb_ctx_t c = { keys, keys + len, keys + 2 * len, pay, pay + max_w * len,
+                               pay + 2 * max_w * len, len, w, keep_low };
+                double s = mb_time(w ? mb_merge_kv : mb_merge, &c);
+                double bytes = 3.0 * (sizeof(int) + w) * len;   // two runs in, one out
+                fprintf(f, "%s\n    {\"name\": \"%s\", \"n\": %zu, \"payload\": %zu, \"keep_low\": %d, "
+                           "\"ns\": %.1f, \"ns_per_key\": %.4f, \"gbps\": %.3f}",
+                        first ? "" : ",", w ? "merge_and_select_kv" : "merge_and_select", len, w,
+                        keep_low, s * 1e9, s * 1e9 / (2.0 * len), bytes / s / 1e9);
+                first = 0;
+            }
+        }
+    }
+    fprintf(f, "\n  ]\n}\n");
+    if (path) fclose(f);
+    free_aligned(keys);
+    free_aligned(pay);
+    return 0;
+}
+
+// Communication profile (--profile[=FILE])
+// Explicit timers around every stage of the full sort: scatter, local sort,
+// each network step and gather. Per stage and rank it records bytes sent,
+// seconds inside MPI transfers (comm), seconds merging/sorting (compute) and
+// seconds at the barrier that closes the stage (wait). Rank 0 gathers them
+// into one table with avg/max per stage and the imbalance max/avg of
+// comm+compute; FILE gets the raw per-rank rows as CSV. Without --profile
+// none of the stage timers run.
+
+typedef struct {
+    double bytes, comm, compute, wait;   // all doubles: gathered as MPI_DOUBLE
+} prof_stage_t;
+
+// Stage 0 scatter, 1 local sort, 2.. network steps, last gather
+static void prof_label(int net, int size, int s, int nstages, char *buf, size_t len) {
+    if (s == 0) { snprintf(buf, len, "scatter"); return; }
+    if (s == 1) { snprintf(buf, len, "local sort"); return; }
+    if (s == nstages - 1) { snprintf(buf, len, "gather"); return; }
+    int st = s - 2, c = 0;
+    if (net == NET_BITONIC) {
+        for (int k = 2; k <= size; k <<= 1)
+            for (int j = k >> 1; j > 0; j >>= 1)
+                if (c++ == st) { snprintf(buf, len, "k=%d j=%d", k, j); return; }
+    }
+    snprintf(buf, len, "step %d", st);
+}
+
+// One table row from size per-rank records spaced stride apart
+static void prof_row(const char *label, const prof_stage_t *p, int stride, int size) {
+    double bytes = 0, comm = 0, comm_max = 0, comp = 0, comp_max = 0, wait_max = 0;
+    double busy = 0, busy_max = -1;
+    int slowest = 0;
+    for (int r = 0; r < size; ++r) {
+        const prof_stage_t *x = &p[(size_t)r * stride];
+        double b = x->comm + x->compute;
+        bytes += x->bytes;
+        comm += x->comm;
+        comp += x->compute;
+        busy += b;
+        if (x->comm > comm_max) comm_max = x->comm;
+        if (x->compute > comp_max) comp_max = x->compute;
+        if (x->wait > wait_max) wait_max = x->wait;
+        if (b > busy_max) { busy_max = b; slowest = r; }
+    }
+    busy /= size;
+    printf("%-12s %12.0f %10.6f %10.6f %10.6f %10.6f %10.6f %9.2f %7d\n", label, bytes / size,
+           comm / size, comm_max, comp / size, comp_max, wait_max,
+           busy > 0 ? busy_max / busy : 1.0, slowest);
+}
+
+// Gather every rank's stages on rank 0, print the table, optionally write CSV
+void prof_report(const prof_stage_t *prof, int nstages, int net, const char *csv, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    prof_stage_t *all = NULL;
+    if (rank == 0) {
+        all = (prof_stage_t*)malloc(sizeof(prof_stage_t) * nstages * size);
+        if (!all) { perror("malloc profile"); MPI_Abort(comm, 1); }
+    }
+    MPI_Gather(prof, nstages * 4, MPI_DOUBLE, all, nstages * 4, MPI_DOUBLE, 0, comm);
+    if (rank != 0) return;
+
+    FILE *f = NULL;
+    if (csv) {
+        f = fopen(csv, "w");
+        if (!f) perror(csv);
+        else fprintf(f, "stage,rank,bytes_sent,comm_s,compute_s,wait_s\n");
+    }
+    printf("Profile (%d ranks; seconds; imbalance = max/avg of comm+compute):\n", size);
+    printf("%-12s %12s %10s %10s %10s %10s %10s %9s %7s\n", "stage", "bytes/rank", "comm avg",
+           "comm max", "comp avg", "comp max", "wait max", "imbalance", "slowest");
+    prof_stage_t *total = (prof_stage_t*)calloc(size, sizeof(prof_stage_t));
+    if (!total) { perror("malloc profile"); MPI_Abort(comm, 1); }
+    for (int s = 0; s < nstages; ++s) {
+        char label[32];
+        prof_label(net, size, s, nstages, label, sizeof(label));
+        prof_row(label, &all[s], nstages, size);
+        for (int r = 0; r < size; ++r) {
+            const prof_stage_t *x = &all[(size_t)r * nstages + s];
+            total[r].bytes += x->bytes;
+            total[r].comm += x->comm;
+            total[r].compute += x->compute;
+            total[r].wait += x->wait;
+            if (f) fprintf(f, "%s,%d,%.0f,%.9f,%.9f,%.9f\n", label, r, x->bytes, x->comm,
+                           x->compute, x->wait);
+        }
+    }
+    prof_row("total", total, 1, size);
+    if (f) { fclose(f); printf("Profile CSV: %s\n", csv); }
+    free(total);
+    free(all);
+}
+
+// Energy report (--energy): node leaders measure; rank 0 prints the joules
+// summed over nodes, per million input keys (n, not the padded N)
+void rapl_report_ranks(const rapl_t *r, int leader, const char *phase, const rapl_sample_t *a,
+                 const rapl_sample_t *b, size_t keys, MPI_Comm comm) {
+    double j[2] = { 0.0, 0.0 }, sum[2];
+    if (leader && r->count) rapl_delta(r, a, b, &j[0], &j[1]);
+    MPI_Reduce(j, sum, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (rank == 0) rapl_print(phase, size, sum[0], sum[1], keys);
 }
 
 int main(int argc, char **argv) {
@@ -84,12 +843,82 @@ int main(int argc, char **argv) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc < 2 && rank == 0) {
-        printf("Usage: %s <n>\n", argv[0]);
+    // Positional arguments are n and payload_bytes; options start with "--"
+    const char *pos[2] = { NULL, NULL };
+    int npos = 0;
+    long long select_k = -1;        // --select=K: global rank K (0-based, K < n)
+    int select_set = 0;
+    const char *quantiles = NULL;   // --quantiles=0.5,0.99
+    long long topk = 0;             // --topk=K: K smallest keys on rank 0
+    const char *network = "bitonic"; // --network=bitonic|oddeven|pairwise
+    int bench = 0;                  // --microbench[=FILE]: kernel microbenchmarks as JSON
+    const char *bench_json = NULL;
+    int energy = 0;                 // --energy: RAPL joules per phase, one reader per node
+    int profile = 0;                // --profile[=FILE]: per-stage comm/compute table, CSV per rank
+    const char *profile_csv = NULL;
+    const char *keys = "int";       // --keys=int|uuid|pair: 128-bit keys for uuid and pair
+    for (int a = 1; a < argc; ++a) {
+        if (strncmp(argv[a], "--select=", 9) == 0) { select_k = atoll(argv[a] + 9); select_set = 1; }
+        else if (strncmp(argv[a], "--quantiles=", 12) == 0) quantiles = argv[a] + 12;
+        else if (strncmp(argv[a], "--topk=", 7) == 0) topk = atoll(argv[a] + 7);
+        else if (strncmp(argv[a], "--network=", 10) == 0) network = argv[a] + 10;
+        else if (strcmp(argv[a], "--microbench") == 0) bench = 1;
+        else if (strncmp(argv[a], "--microbench=", 13) == 0) { bench = 1; bench_json = argv[a] + 13; }
+        else if (strcmp(argv[a], "--energy") == 0) energy = 1;
+        else if (strcmp(argv[a], "--profile") == 0) profile = 1;
+        else if (strncmp(argv[a], "--profile=", 10) == 0) { profile = 1; profile_csv = argv[a] + 10; }
+        else if (strncmp(argv[a], "--keys=", 7) == 0) keys = argv[a] + 7;
+        else if (npos < 2) pos[npos++] = argv[a];
+    }
+    int select_mode = (select_set || quantiles != NULL);
+    int topk_mode = (topk > 0);
+    if (profile && (select_mode || topk_mode)) {
+        // The stage table follows the sort network; selection and top-k have none
+        if (rank == 0) fprintf(stderr, "WARNING: --profile covers the full sort only; ignored with --select, --quantiles and --topk\n");
+        profile = 0;
+    }
+    int net = strcmp(network, "oddeven") == 0 ? NET_ODDEVEN :
+              strcmp(network, "pairwise") == 0 ? NET_PAIRWISE : NET_BITONIC;
+    if (net == NET_BITONIC && strcmp(network, "bitonic") != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: unknown network '%s' (bitonic, oddeven or pairwise)\n", network);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int wide = strcmp(keys, "uuid") == 0 || strcmp(keys, "pair") == 0;
+    if (!wide && strcmp(keys, "int") != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: unknown key type '%s' (int, uuid or pair)\n", keys);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    if (bench) {
+        int rc = rank == 0 ? microbench(bench_json) : 0;
+        MPI_Finalize();
+        return rc;
+    }
+
+    if (npos < 1 && rank == 0) {
+        printf("Usage: %s <n> [payload_bytes: 0|4|8|16] [--select=K] [--quantiles=p1,p2,...] [--topk=K] [--network=bitonic|oddeven|pairwise] [--energy] [--profile[=FILE]] [--keys=int|uuid|pair]\n", argv[0]);
+    }
+    size_t n = 1024;
+    if (npos > 0) {
+        long long v = atoll(pos[0]);
+        if (v > 0) n = (size_t)v;
+    }
+    // Optional payload per key (row ID records); 0 keeps the key-only path
+    size_t w = 0;
+    if (npos > 1) w = (size_t)atoi(pos[1]);
+    if (select_mode || topk_mode) w = 0; // selection returns keys only
+    if (wide && (w || select_mode || topk_mode || energy || profile)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --keys=%s runs the plain full sort (no payload, select, topk, energy or profile)\n", keys);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (select_set && (select_k < 0 || (unsigned long long)select_k >= n)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --select=%lld is out of range (0 <= K < n = %zu)\n", select_k, n);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (w != 0 && w != 4 && w != 8 && w != 16) {
+        if (rank == 0) fprintf(stderr, "ERROR: payload_bytes must be 0, 4, 8 or 16 (got %zu)\n", w);
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    int n = 1024;
-    if (argc > 1) n = atoi(argv[1]);
-    if (n <= 0) n = 1024;
 
     // Need power of 2 processes
     if (!is_power_of_two(size)) {
@@ -98,95 +927,350 @@ int main(int argc, char **argv) {
     }
 
     // Pad array size to work with process count
-    int N = next_power_of_two(n);
-    while (N % size != 0) N <<= 1; // increase until divisible by processes
+    size_t N = next_power_of_two(n);
+    while (N % (size_t)size != 0) N <<= 1; // increase until divisible by processes
 
-    int local_size = N / size;
-    if (local_size <= 0) {
-        if (rank == 0) fprintf(stderr, "ERROR: local_size <= 0 (N=%d size=%d)\n", N, size);
+    size_t local_size = N / (size_t)size;
+    if (local_size == 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: local_size == 0 (N=%zu size=%d)\n", N, size);
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
     if (rank == 0) {
-        printf("MPI checked bitonic: requested n=%d padded N=%d processes=%d local_size=%d\n",
+        printf("MPI checked bitonic: requested n=%zu padded N=%zu processes=%d local_size=%zu\n",
                n, N, size, local_size);
+        if (w) printf("Records: int key + %zu-byte payload\n", w);
+        if (wide) printf("Keys: %s (128-bit)\n", keys);
+    }
+    if (wide) {
+        int rc = sort_k128_distributed(n, N, net, network, strcmp(keys, "pair") == 0, MPI_COMM_WORLD);
+        MPI_Finalize();
+        return rc;
+    }
+
+    // Payload bytes travel as one committed w-byte record type
+    MPI_Datatype payload_type = MPI_DATATYPE_NULL;
+    if (w) {
+        MPI_Type_contiguous((int)w, MPI_BYTE, &payload_type);
+        MPI_Type_commit(&payload_type);
     }
 
     // Memory allocation
+    // Single root: rank 0 generates the whole padded input (the same srand(42)
+    // sequence as the other programs), scatters it and gathers the result, so
+    // it needs 4N bytes (plus (w+4)N with payloads) on top of its block and
+    // caps n at what one node can hold.
     int *global_arr = NULL;
     if (rank == 0) {
-        global_arr = (int*)malloc(sizeof(int) * N);
+        global_arr = (int*)aligned_buffer(sizeof(int) * N);
         if (!global_arr) { perror("malloc global_arr"); MPI_Abort(MPI_COMM_WORLD, 1); }
         // Initialize with random data
         srand(42);
-        for (int i = 0; i < n; ++i) global_arr[i] = rand() % 1000000;
-        for (int i = n; i < N; ++i) global_arr[i] = INT_MAX;
+        for (size_t i = 0; i < n; ++i) global_arr[i] = rand() % 1000000;
+        for (size_t i = n; i < N; ++i) global_arr[i] = INT_MAX;
+    }
+
+    // Record mode: payload carries the row ID; rank 0 keeps the input keys to check it
+    unsigned char *global_payload = NULL;
+    int *orig_keys = NULL;
+    if (rank == 0 && w) {
+        global_payload = (unsigned char*)aligned_buffer(w * N);
+        orig_keys = (int*)malloc(sizeof(int) * N);
+        if (!global_payload || !orig_keys) { perror("malloc records"); MPI_Abort(MPI_COMM_WORLD, 1); }
+        for (size_t i = 0; i < N; ++i) set_payload_row_id(global_payload + i * w, w, i);
+        memcpy(orig_keys, global_arr, sizeof(int) * N);
     }
 
-    int *local = (int*)malloc(sizeof(int) * local_size);
+    int *local = (int*)aligned_buffer(sizeof(int) * local_size);
     if (!local) { perror("malloc local"); MPI_Abort(MPI_COMM_WORLD, 1); }
 
+    // The three payload buffers share one allocation, each PAYLOAD_SKEW bytes
+    // off the alignment of the key buffers: with 4-byte payloads a key and its
+    // payload would otherwise map to the same cache set at every stride
+    unsigned char *payload_arena = NULL;
+    unsigned char *local_payload = NULL, *recv_payload = NULL, *new_payload = NULL;
+    if (w) {
+        payload_arena = (unsigned char*)aligned_buffer(3 * (w * local_size + PAYLOAD_SKEW));
+        if (!payload_arena) { perror("malloc payload"); MPI_Abort(MPI_COMM_WORLD, 1); }
+        local_payload = payload_arena + PAYLOAD_SKEW;
+        recv_payload = local_payload + w * local_size + PAYLOAD_SKEW;
+        new_payload = recv_payload + w * local_size + PAYLOAD_SKEW;
+    }
+
+    // Energy: ranks sharing a node share its counters, so only node rank 0 reads them
+    rapl_t rapl = { 0 };
+    rapl_sample_t e0, e1, e2, e3;
+    int leader = 0;
+    if (energy) {
+        MPI_Comm node;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+        int node_rank;
+        MPI_Comm_rank(node, &node_rank);
+        MPI_Comm_free(&node);
+        leader = node_rank == 0;
+        int zones = leader ? rapl_open(&rapl) : 0, readable = 0;
+        MPI_Allreduce(&zones, &readable, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        if (!readable) {
+            if (rank == 0) printf("Energy: RAPL counters not readable under %s\n", RAPL_ROOT);
+            energy = 0;
+        }
+    }
+
+#ifdef SORT_STATS
+    sort_stats_reset();
+    STAT_ADD(scratch_bytes, 3 * w * local_size);   // payload, receive and merge buffers
+#endif
+
     // MPI: Distribute data chunks to all processes
     MPI_Barrier(MPI_COMM_WORLD); // sync before timing
+    if (energy) rapl_read(&rapl, &e0);
     double t0 = MPI_Wtime();
-    MPI_Scatter(global_arr, local_size, MPI_INT, local, local_size, MPI_INT, 0, MPI_COMM_WORLD);
+    scatter_block(global_arr, local, local_size, MPI_INT, 0, MPI_COMM_WORLD);
+    if (w) scatter_block(global_payload, local_payload, local_size, payload_type, 0, MPI_COMM_WORLD);
+    double ts = MPI_Wtime();
+    size_t rec_bytes = sizeof(int) + w;
+    split_step_t steps[64 * 65 / 2];
+    int nsteps = network_schedule(net, rank, size, steps);
+    prof_stage_t *prof = NULL;
+    if (profile) {
+        prof = (prof_stage_t*)calloc(nsteps + 3, sizeof(prof_stage_t));
+        if (!prof) { perror("malloc profile"); MPI_Abort(MPI_COMM_WORLD, 1); }
+        prof[0].comm = ts - t0;
+        prof[0].bytes = rank == 0 ? (double)(N - local_size) * rec_bytes : 0.0;
+    }
+
+    // Top-k mode: local partial network, then a log P reduction moving K keys per level
+    if (topk_mode) {
+        size_t k = (size_t)topk < n ? (size_t)topk : n;
+        size_t K = next_power_of_two(k);
+        int *best = (int*)aligned_buffer(sizeof(int) * K * 3);
+        if (!best) { perror("malloc topk"); MPI_Abort(MPI_COMM_WORLD, 1); }
+        if (K <= local_size) {
+            local_topk(local, local_size, K);
+            memcpy(best, local, sizeof(int) * K);
+        } else {
+            // Fewer local keys than K: sort them all and pad with INT_MAX
+            bitonic_sort_recursive(local, 0, local_size, 1);
+            memcpy(best, local, sizeof(int) * local_size);
+            for (size_t i = local_size; i < K; ++i) best[i] = INT_MAX;
+        }
+        reduce_topk(best, best + K, best + 2 * K, K, MPI_COMM_WORLD);
+        double t1 = MPI_Wtime();
+        if (energy) {
+            MPI_Barrier(MPI_COMM_WORLD); // phase ends when the slowest rank is done
+            rapl_read(&rapl, &e1);
+        }
+
+        if (rank == 0) {
+            printf("Elapsed time: %.6f s\n", t1 - t0);
+            printf("Top-%zu:", k);
+            for (size_t i = 0; i < k && i < 16; ++i) printf(" %d", best[i]);
+            printf(k > 16 ? " ...\n" : "\n");
+            // Compare against the first k keys of a fully sorted copy
+            bitonic_sort_recursive(global_arr, 0, N, 1);
+            int ok = memcmp(best, global_arr, sizeof(int) * k) == 0;
+            printf("Result: %s\n", ok ? "TOP-K OK" : "TOP-K WRONG");
+            free_aligned(global_arr);
+        }
+        if (energy) rapl_report_ranks(&rapl, leader, "scatter+top-k", &e0, &e1, n, MPI_COMM_WORLD);
+        free_aligned(best);
+        free_aligned(local);
+        MPI_Finalize();
+        return 0;
+    }
 
     // Each process sorts its local chunk independently
-    bitonic_sort_recursive(local, 0, local_size, 1);
+    uint64_t local_in_hash = select_mode ? 0 : multiset_hash(local, local_size);
+    if (w) bitonic_sort_recursive_kv(local, local_payload, w, 0, local_size, 1);
+    else bitonic_sort_recursive(local, 0, local_size, 1);
+    double tl = MPI_Wtime();
+    if (prof) prof[1].compute = tl - ts;
+    if ((energy || profile) && !select_mode) {
+        MPI_Barrier(MPI_COMM_WORLD); // phase ends when the slowest rank is done
+        if (prof) prof[1].wait = MPI_Wtime() - tl;
+        if (energy) rapl_read(&rapl, &e1);
+    }
 
-    // Buffers for data exchange
-    int *recv_buf = (int*)malloc(sizeof(int) * local_size);
-    int *new_local = (int*)malloc(sizeof(int) * local_size);
-    if (!recv_buf || !new_local) { perror("malloc buffers"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    // Selection mode: answer rank queries from the local sorts, skip the network
+    if (select_mode) {
+        // One query per quantile (commas + 1) plus --select
+        int maxq = 1 + (quantiles != NULL);
+        for (const char *q = quantiles; q && *q; ++q) maxq += (*q == ',');
+        unsigned long long *ks = (unsigned long long*)malloc(sizeof(unsigned long long) * maxq);
+        double *ps = (double*)malloc(sizeof(double) * maxq);
+        int *values = (int*)malloc(sizeof(int) * maxq), *rounds = (int*)malloc(sizeof(int) * maxq);
+        if (!ks || !ps || !values || !rounds) { perror("malloc queries"); MPI_Abort(MPI_COMM_WORLD, 1); }
+        int nq = 0;
+        if (select_set) { ks[nq] = (unsigned long long)select_k; ps[nq++] = -1.0; }
+        for (const char *q = quantiles; q && *q; ) {
+            double p = atof(q);
+            if (p < 0.0) p = 0.0;
+            if (p > 1.0) p = 1.0;
+            // Nearest-rank quantile: smallest key with at least p*n keys <= it
+            double r = p * (double)n;
+            unsigned long long c = (unsigned long long)r;
+            if ((double)c < r) ++c; // ceil without libm
+            ks[nq] = c == 0 ? 0 : c > n ? n - 1 : c - 1; // n > 2^53 rounds p*n up
+            ps[nq++] = p;
+            q = strchr(q, ',');
+            if (q) ++q;
+        }
 
-    // MPI: Distributed bitonic network - log(P) phases of partner communication
-    for (int k = 2; k <= size; k <<= 1) {
-        for (int j = k >> 1; j > 0; j >>= 1) {
-            int partner = rank ^ j; // XOR to find communication partner
+        for (int i = 0; i < nq; ++i) {
+            values[i] = distributed_select(local, local_size, ks[i], MPI_COMM_WORLD, &rounds[i]);
+        }
+        double t1 = MPI_Wtime();
+        if (energy) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            rapl_read(&rapl, &e1);
+        }
 
-            // Determine sort direction based on position in bitonic network
-            int ascending_block = ((rank & k) == 0);
-            int lower_partner = ((rank & j) == 0);
-            int keep_low = ascending_block ? lower_partner : (1 - lower_partner);
+        if (rank == 0) {
+            printf("Elapsed time: %.6f s\n", t1 - t0);
+            // Check each answer by counting keys below / up to it in the input
+            int ok = 1;
+            for (int i = 0; i < nq; ++i) {
+                size_t lt = 0, le = 0;
+                for (size_t x = 0; x < n; ++x) {
+                    lt += global_arr[x] < values[i];
+                    le += global_arr[x] <= values[i];
+                }
+                if (!(lt <= ks[i] && ks[i] < le)) ok = 0;
+                if (ps[i] >= 0.0) printf("p%g (rank %llu): %d [%d rounds]\n", ps[i] * 100.0, ks[i], values[i], rounds[i]);
+                else printf("rank %llu: %d [%d rounds]\n", ks[i], values[i], rounds[i]);
+            }
+            printf("Result: %s\n", ok ? "SELECTED" : "WRONG RANK");
+            free_aligned(global_arr);
+        }
+        if (energy) rapl_report_ranks(&rapl, leader, "scatter+local sort+select", &e0, &e1, n, MPI_COMM_WORLD);
+        free(ks); free(ps); free(values); free(rounds);
+        free_aligned(local);
+        MPI_Finalize();
+        return 0;
+    }
 
-            // MPI: Exchange sorted chunks with partner process
-            MPI_Sendrecv(local, local_size, MPI_INT, partner, 0,
-                         recv_buf, local_size, MPI_INT, partner, 0,
-                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    // Buffers for data exchange
+    int *recv_buf = (int*)aligned_buffer(sizeof(int) * local_size);
+    int *new_local = (int*)aligned_buffer(sizeof(int) * local_size);
+    if (!recv_buf || !new_local) { perror("malloc buffers"); MPI_Abort(MPI_COMM_WORLD, 1); }
+    STAT_ADD(scratch_bytes, 2 * sizeof(int) * local_size);
 
-            // Merge received data and keep smaller/larger half
-            merge_and_select(local, recv_buf, new_local, local_size, keep_low);
-            memcpy(local, new_local, sizeof(int) * local_size);
+    // MPI: Distributed network over the ranks - one compare-split per step
+    long long splits = 0;
+    for (int st = 0; st < nsteps; st++) {
+        int partner = steps[st].partner;
+        int keep_low = steps[st].keep_low;
+        prof_stage_t *ps = prof ? &prof[2 + st] : NULL;
+        double ta = ps ? MPI_Wtime() : 0.0, tb = 0.0;
+        if (partner >= 0) {
+            splits++;
+            // MPI: Exchange sorted chunks with partner process
+            sendrecv_block(local, recv_buf, local_size, MPI_INT, partner, MPI_COMM_WORLD);
 
-            MPI_Barrier(MPI_COMM_WORLD); // sync after each merge step
+            if (w) {
+                // Second exchange for the payload array, then merge keys with payloads
+                sendrecv_block(local_payload, recv_payload, local_size, payload_type, partner, MPI_COMM_WORLD);
+                if (ps) tb = MPI_Wtime();
+                merge_and_select_kv(local, local_payload, recv_buf, recv_payload,
+                                    new_local, new_payload, w, local_size, keep_low);
+                int *kt = local; local = new_local; new_local = kt;
+                unsigned char *pt = local_payload; local_payload = new_payload; new_payload = pt;
+            } else {
+                // Merge received data and keep smaller/larger half
+                if (ps) tb = MPI_Wtime();
+                merge_and_select(local, recv_buf, new_local, local_size, keep_low);
+                int *kt = local; local = new_local; new_local = kt;
+            }
+            if (ps) {
+                ps->bytes = (double)local_size * rec_bytes;
+                ps->comm = tb - ta;
+                ps->compute = MPI_Wtime() - tb;
+            }
         }
+
+        double tw = ps ? MPI_Wtime() : 0.0;
+        MPI_Barrier(MPI_COMM_WORLD); // sync after each merge step
+        if (ps) ps->wait = MPI_Wtime() - tw;
     }
+    long long total_splits = 0;
+    MPI_Reduce(&splits, &total_splits, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
     // MPI: Gather sorted chunks back to process 0
-    MPI_Gather(local, local_size, MPI_INT, global_arr, local_size, MPI_INT, 0, MPI_COMM_WORLD);
+    double tg = prof ? MPI_Wtime() : 0.0;
+    gather_block(local, global_arr, local_size, MPI_INT, 0, MPI_COMM_WORLD);
+    if (w) gather_block(local_payload, global_payload, local_size, payload_type, 0, MPI_COMM_WORLD);
+    double tw = prof ? MPI_Wtime() : 0.0;
     MPI_Barrier(MPI_COMM_WORLD);
     double t1 = MPI_Wtime();
+    if (prof) {
+        prof_stage_t *pg = &prof[2 + nsteps];
+        pg->comm = tw - tg;
+        pg->wait = t1 - tw;
+        pg->bytes = rank != 0 ? (double)local_size * rec_bytes : 0.0;
+    }
+    if (energy) rapl_read(&rapl, &e2);
+
+    // Order across all N keys and permutation of the input, on the distributed blocks
+    dist_verify_t v;
+    verify_distributed(local, local_size, local_in_hash, &v, MPI_COMM_WORLD);
+    double t2 = MPI_Wtime();
+    if (energy) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        rapl_read(&rapl, &e3);
+    }
 
     if (rank == 0) {
         double elapsed = t1 - t0;
         printf("Elapsed time: %.6f s\n", elapsed);
-        int ok = verify_sorted(global_arr, n);
+        printf("Network: %s, %d steps, %lld compare-splits\n", network, nsteps, total_splits / 2);
+        printf("Verify: %.6f s\n", t2 - t1);
+        int ok = v.sorted;
         printf("Result: %s\n", ok ? "SORTED" : "NOT SORTED");
+        printf("Checksum: %s (%016llx)\n", v.out_hash == v.in_hash ? "MATCH" : "MISMATCH",
+               (unsigned long long)v.out_hash);
+        if (w) {
+            // Every payload must still name a row whose input key matches
+            int rows_ok = 1;
+            for (size_t i = 0; i < N && rows_ok; ++i) {
+                size_t row = payload_row_id(global_payload + i * w, w);
+                if (row >= N || orig_keys[row] != global_arr[i]) rows_ok = 0;
+            }
+            printf("Payloads: %s\n", rows_ok ? "MATCH KEYS" : "MISMATCH");
+        }
         if (!ok) {
             fprintf(stderr, "DEBUG: printing first 64 values (padding shown as INT_MAX):\n");
-            int end = (n < 64) ? n : 64;
-            for (int i = 0; i < end; ++i) {
+            size_t end = (n < 64) ? n : 64;
+            for (size_t i = 0; i < end; ++i) {
                 if (global_arr[i] == INT_MAX) printf("[PAD] ");
                 else printf("%d ", global_arr[i]);
             }
             printf("\n");
         }
-        free(global_arr);
+        free_aligned(global_arr);
+        free_aligned(global_payload);
+        free(orig_keys);
+    }
+
+#ifdef SORT_STATS
+    sort_stats_t stats;
+    sort_stats_reduce(&stats, MPI_COMM_WORLD);
+    if (rank == 0) sort_stats_print(&stats, N, size);
+#endif
+    if (prof) {
+        prof_report(prof, nsteps + 3, net, profile_csv, MPI_COMM_WORLD);
+        free(prof);
+    }
+    if (energy) {
+        rapl_report_ranks(&rapl, leader, "scatter+local sort", &e0, &e1, n, MPI_COMM_WORLD);
+        rapl_report_ranks(&rapl, leader, "network+gather", &e1, &e2, n, MPI_COMM_WORLD);
+        rapl_report_ranks(&rapl, leader, "verify", &e2, &e3, n, MPI_COMM_WORLD);
     }
 
-    free(local);
-    free(recv_buf);
-    free(new_local);
+    free_aligned(local);
+    free_aligned(recv_buf);
+    free_aligned(new_local);
+    free_aligned(payload_arena);
+    if (w) MPI_Type_free(&payload_type);
 
     MPI_Finalize(); // cleanup MPI environment
     return 0;
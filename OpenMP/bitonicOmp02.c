@@ -7,38 +7,136 @@
 #include <limits.h>
 #include <time.h>
 #include <omp.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
 #include <sys/time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-/* swap two integers */
-static inline void swap_int(int *a, int *b) {
-    int t = *a;
-    *a = *b;
-    *b = t;
+#include "../Common/bitonic_common.h"
+
+// Statistics counters (-DSORT_STATS): each thread counts into its own cache
+// line, claimed on first use, and sort_stats_get() sums them. The task sites
+// count spawned tasks and their deepest nesting.
+#ifdef SORT_STATS
+#define STAT_MAX_THREADS 1024   // threads beyond this share the last block
+
+typedef struct { _Alignas(64) sort_stats_t s; } stat_slot_t;
+static stat_slot_t stat_slots[STAT_MAX_THREADS];
+static int stat_nslots;
+static _Thread_local sort_stats_t *stat_mine;
+static _Thread_local int stat_depth;   // nesting of the task this thread runs
+
+static inline sort_stats_t *stat_self(void) {
+    if (!stat_mine) {
+        int i;
+        #pragma omp atomic capture
+        i = stat_nslots++;
+        stat_mine = &stat_slots[i < STAT_MAX_THREADS ? i : STAT_MAX_THREADS - 1].s;
+    }
+    return stat_mine;
+}
+
+// Task body entry at depth parent + 1; returns the depth to restore on exit
+static inline int stat_task_enter(int parent) {
+    sort_stats_t *s = stat_self();
+    int saved = stat_depth;
+    stat_depth = parent + 1;
+    s->tasks++;
+    if ((unsigned long long)stat_depth > s->max_depth) s->max_depth = stat_depth;
+    return saved;
+}
+
+void sort_stats_reset(void) {
+    for (int i = 0; i < stat_nslots && i < STAT_MAX_THREADS; i++)
+        memset(&stat_slots[i].s, 0, sizeof(sort_stats_t));
+}
+
+void sort_stats_get(sort_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < stat_nslots && i < STAT_MAX_THREADS; i++) {
+        const sort_stats_t *s = &stat_slots[i].s;
+        out->compares += s->compares;
+        out->swaps += s->swaps;
+        for (int c = 0; c < STAT_CLASSES; c++) out->pass_keys[c] += s->pass_keys[c];
+        out->tasks += s->tasks;
+        if (s->max_depth > out->max_depth) out->max_depth = s->max_depth;
+        out->scratch_bytes += s->scratch_bytes;
+    }
+}
+
+#define STAT_MAX(field, v) do {                                \
+        sort_stats_t *s_ = stat_self();                        \
+        if ((unsigned long long)(v) > s_->field) s_->field = (v); \
+    } while (0)
+#define STAT_PARENT int stat_parent_ = stat_depth
+#define STAT_TASK(stmt) do {                                   \
+        int stat_saved_ = stat_task_enter(stat_parent_);       \
+        stmt;                                                  \
+        stat_depth = stat_saved_;                              \
+    } while (0)
+#else
+#define STAT_MAX(field, v) ((void)0)
+#define STAT_PARENT ((void)0)
+#define STAT_TASK(stmt) stmt
+#endif
+
+// Radix-4 companion of compare_exchange_radix8 for the last two levels above a
+// fused block, in work items of MULTI_LEVEL_CHUNK columns
+#define MULTI_LEVEL_CHUNK 1024     // columns per work item (8 x 4 KB streams)
+
+// Levels 2q and q on p[t + r*q], r = 0..3, t < len
+static void compare_exchange_radix4(int *p, size_t q, size_t len, int dir) {
+    STAT_PASS(q, 4 * len);
+    for (size_t t = 0; t < len; t++) {
+        int v0 = p[t], v1 = p[t + q], v2 = p[t + 2 * q], v3 = p[t + 3 * q];
+        CMPX(v0, v2, dir); CMPX(v1, v3, dir);
+        CMPX(v0, v1, dir); CMPX(v2, v3, dir);
+        p[t] = v0; p[t + q] = v1; p[t + 2 * q] = v2; p[t + 3 * q] = v3;
+    }
 }
 
 // Bitonic merge with task-based parallelism
-void bitonic_merge(int arr[], int low, int cnt, int dir) {
+void bitonic_merge(int arr[], size_t low, size_t cnt, int dir) {
+    STAT_PARENT;
+    if (cnt > MULTI_LEVEL_MIN) {
+        // Out of cache: three levels per sweep, split in cache-sized chunks
+        size_t q = cnt / 8;
+        #pragma omp parallel for schedule(static)
+        for (size_t c = 0; c < q; c += MULTI_LEVEL_CHUNK) {
+            size_t len = q - c < MULTI_LEVEL_CHUNK ? q - c : MULTI_LEVEL_CHUNK;
+            compare_exchange_radix8(&arr[low + c], q, len, dir);
+        }
+
+        // Eight independent sub-merges
+        for (size_t r = 0; r < 8; r++) {
+            #pragma omp task firstprivate(r)
+            STAT_TASK(bitonic_merge(arr, low + r * q, q, dir));
+        }
+        #pragma omp taskwait
+        return;
+    }
     if (cnt > 1) {
-        int k = cnt / 2;
+        size_t k = cnt / 2;
 
-        // Parallel compare-exchange operations
+        // Parallel compare-exchange operations (vector kernel per chunk)
         #pragma omp parallel for schedule(static) if(k > 1000)
-        for (int i = low; i < low + k; i++) {
-            if (dir == 1) {                // ascending
-                if (arr[i] > arr[i + k]) swap_int(&arr[i], &arr[i + k]);
-            } else {                       // descending
-                if (arr[i] < arr[i + k]) swap_int(&arr[i], &arr[i + k]);
-            }
+        for (size_t c = 0; c < k; c += MULTI_LEVEL_CHUNK) {
+            size_t len = k - c < MULTI_LEVEL_CHUNK ? k - c : MULTI_LEVEL_CHUNK;
+            compare_exchange_run(&arr[low + c], &arr[low + k + c], len, dir, 0);
         }
 
         // Create tasks for recursive calls (only for large chunks)
         // Tasks allow dynamic work distribution among all threads
         if (k > 2048) {
             #pragma omp task
-            bitonic_merge(arr, low, k, dir);
+            STAT_TASK(bitonic_merge(arr, low, k, dir));
             
             #pragma omp task
-            bitonic_merge(arr, low + k, k, dir);
+            STAT_TASK(bitonic_merge(arr, low + k, k, dir));
             
             #pragma omp taskwait
         } else {
@@ -50,17 +148,18 @@ void bitonic_merge(int arr[], int low, int cnt, int dir) {
 }
 
 // Bitonic sort with task-based parallelism
-void bitonic_sort_recursive(int arr[], int low, int cnt, int dir) {
+void bitonic_sort_recursive(int arr[], size_t low, size_t cnt, int dir) {
+    STAT_PARENT;
     if (cnt > 1) {
-        int k = cnt / 2;
+        size_t k = cnt / 2;
 
         // Create tasks for recursive calls
         if (k > 2048) {
             #pragma omp task
-            bitonic_sort_recursive(arr, low, k, 1);      // 1st half ascending
+            STAT_TASK(bitonic_sort_recursive(arr, low, k, 1));      // 1st half ascending
 
             #pragma omp task
-            bitonic_sort_recursive(arr, low + k, k, 0);  // 2nd half descending
+            STAT_TASK(bitonic_sort_recursive(arr, low + k, k, 0));  // 2nd half descending
             
             #pragma omp taskwait
         } else {
@@ -75,7 +174,7 @@ void bitonic_sort_recursive(int arr[], int low, int cnt, int dir) {
 }
 
 // Initialize parallel region for task execution
-void bitonic_sort_parallel(int arr[], int n) {
+void bitonic_sort_parallel(int arr[], size_t n) {
     #pragma omp parallel
     {
         // One thread creates tasks, others execute them
@@ -86,62 +185,1287 @@ void bitonic_sort_parallel(int arr[], int n) {
     }
 }
 
-// Find next power of 2
-int next_power_of_two(int n) {
-    if (n <= 1) return 1;
+// Iterative engine: same launch structure as CUDA/bitonicCUDA.cu
+// The sort is the flat (k, j) sequence of steps; element i pairs with i ^ j and
+// the direction comes from (i & k). One persistent team runs every step as an
+// omp for with an implied barrier, so work per thread is perfectly balanced.
+// Strides beyond a FUSE_BLOCK go three (or two) levels per sweep with the radix
+// kernels. Once 2*j fits in a FUSE_BLOCK, all remaining steps j, j/2, ..., 1 stay
+// inside aligned blocks, so they run fused per block and cost a single barrier.
+#define FUSE_BLOCK 4096
+
+// All steps j, j/2, ..., 1 of stage k inside block [base, base + len)
+// aligned: arr is vector aligned, so runs of whole vectors can skip the peel
+static void bitonic_steps_fused(int arr[], size_t base, size_t len, size_t j, size_t k,
+                                int aligned) {
+    for (; j > 0; j >>= 1) {
+        for (size_t lo = base; lo < base + len; lo += 2 * j) {
+            compare_exchange_run(&arr[lo], &arr[lo + j], j, (lo & k) == 0,
+                                 aligned && j % VEC_INTS == 0);
+        }
+    }
+}
+
+// Streaming mode for out-of-cache strides
+// When the array is larger than the last-level cache, each large-stride sweep
+// reads one buffer and writes the other (ping-pong) with non-temporal stores,
+// so written lines skip the read-for-ownership and don't evict the sources.
+// Loads are software-prefetched PREFETCH_DIST elements ahead on every stream,
+// since strides of many pages defeat the hardware prefetcher.
+#define PREFETCH_DIST 2048  // elements (8 KB, two chunks) ahead of each row
+
+// Copy len ints to dst with non-temporal stores (full 16-byte vectors when aligned)
+static void stream_copy(int *dst, const int *src, size_t len) {
+    size_t t = 0;
+#ifdef __SSE2__
+    if (((uintptr_t)dst & 15) == 0) {
+        for (; t + 4 <= len; t += 4)
+            _mm_stream_si128((__m128i *)(dst + t), _mm_loadu_si128((const __m128i *)(src + t)));
+    }
+    for (; t < len; t++) _mm_stream_si32(dst + t, src[t]);
+#else
+    memcpy(dst, src, sizeof(int) * len);
+    t = len;
+#endif
+}
+
+static inline void stream_fence(void) {
+#ifdef __SSE2__
+    _mm_sfence();   // make streamed lines visible before the barrier
+#endif
+}
+
+// Streaming chunk: gather the 2/4/8 operand rows into a cache-resident stage
+// (prefetching ahead on every source row), run the levels there, and write the
+// rows out to dst with whole-line non-temporal stores.
+static void large_stride_chunk_stream(const int *src, int *dst, size_t q, size_t len,
+                                      int levels, int dir) {
+    _Alignas(CACHE_LINE) int stage[8 * MULTI_LEVEL_CHUNK];
+    size_t rows = (size_t)1 << levels;
+    STAT_PASS(q, rows * len);   // the gather; the kernel below counts the staged pass
+    for (size_t r = 0; r < rows; r++) {
+        const int *row = src + r * q;
+        for (size_t t = 0; t < len; t += 16) __builtin_prefetch(row + t + PREFETCH_DIST, 0, 0);
+        memcpy(stage + r * len, row, sizeof(int) * len);
+    }
+    if (levels == 3) compare_exchange_radix8(stage, len, len, dir);
+    else if (levels == 2) compare_exchange_radix4(stage, len, len, dir);
+    else compare_exchange_run(stage, stage + len, len, dir, len % VEC_INTS == 0);
+    for (size_t r = 0; r < rows; r++) stream_copy(dst + r * q, stage + r * len, len);
+    stream_fence();
+}
+
+// One chunk of a large-stride sweep covering `levels` levels (operands q apart)
+static void large_stride_chunk(const int *src, int *dst, size_t q, size_t len,
+                               int levels, int dir, int streaming) {
+    if (streaming) {
+        large_stride_chunk_stream(src, dst, q, len, levels, dir);
+    } else {
+        if (levels == 3) compare_exchange_radix8(dst, q, len, dir);
+        else if (levels == 2) compare_exchange_radix4(dst, q, len, dir);
+        else compare_exchange_run(dst, dst + q, len, dir, 0);
+    }
+}
+
+// Last-level cache size, 32 MB when the platform can't tell
+size_t llc_bytes(void) {
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    long v = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (v > 0) return (size_t)v;
+#endif
+    return (size_t)32 << 20;
+}
+
+// Achieved bandwidth of large-stride sweeps, indexed by log2 of the top stride
+typedef struct {
+    int levels;        // network levels done per sweep
+    size_t sweeps;
+    double bytes;      // read + written
+    double secs;
+} sweep_stats_t;
+
+// streaming: 1 = ping-pong with non-temporal stores, 0 = in place
+// sweeps: optional per-stride stats (64 entries)
+// verify: when non-NULL, order and hash are folded into the final fused pass
+void bitonic_sort_iterative(int arr[], size_t n, int streaming, sweep_stats_t *sweeps,
+                            verify_t *verify) {
+    size_t block = n < FUSE_BLOCK ? n : FUSE_BLOCK;
+    int *tmp = NULL;
+    if (streaming && n > 2 * block) {
+        tmp = aligned_buffer(sizeof(int) * n);
+        if (!tmp) streaming = 0;   // fall back to in place
+        else STAT_ADD(scratch_bytes, sizeof(int) * n);
+    } else {
+        streaming = 0;
+    }
+    int *cur = arr, *alt = tmp;    // shared; swapped by the master between sweeps
+    int aligned = ((uintptr_t)arr % CACHE_LINE) == 0;  // tmp always is
+    double t_sweep = 0.0;
+    int v_ok = 1;                  // fused verification, reduced over the last stage
+    uint64_t v_hash = 0;
+
+    #pragma omp parallel
+    {
+        for (size_t k = 2; k <= n; k <<= 1) {              // sequence length
+            size_t j = k >> 1;
+            while (2 * j > block) {                         // large strides: up to three levels per sweep
+                int levels = j / 2 > block ? 3 : j > block ? 2 : 1;
+                size_t q = j >> (levels - 1);
+                #pragma omp master
+                t_sweep = omp_get_wtime();
+
+                #pragma omp for collapse(2) schedule(static)
+                for (size_t g = 0; g < n / (2 * j); g++) {
+                    for (size_t c = 0; c < q; c += MULTI_LEVEL_CHUNK) {
+                        size_t base = g * 2 * j + c;
+                        size_t len = q - c < MULTI_LEVEL_CHUNK ? q - c : MULTI_LEVEL_CHUNK;
+                        large_stride_chunk(cur + base, (streaming ? alt : cur) + base, q, len,
+                                           levels, ((g * 2 * j) & k) == 0, streaming);
+                    }
+                }
+
+                #pragma omp master
+                {
+                    if (sweeps) {
+                        int lg = 0;
+                        while (((size_t)1 << lg) < j) lg++;
+                        sweeps[lg].levels = levels;
+                        sweeps[lg].sweeps++;
+                        sweeps[lg].bytes += 2.0 * sizeof(int) * (double)n;
+                        sweeps[lg].secs += omp_get_wtime() - t_sweep;
+                    }
+                    if (streaming) { int *t = cur; cur = alt; alt = t; }
+                }
+                if (streaming) {
+                    #pragma omp barrier
+                }
+                j >>= levels;
+            }
+            // small strides: fuse the rest of stage k per block
+            #pragma omp for schedule(static) reduction(&&:v_ok) reduction(+:v_hash)
+            for (size_t b = 0; b < n / block; b++) {
+                bitonic_steps_fused(cur, b * block, block, j, k, aligned);
+                if (verify && k == n) verify_run(cur + b * block, block, &v_ok, &v_hash);
+            }
+        }
+    }
+
+    if (verify) {
+        if (n < 2) verify_run(cur, n, &v_ok, &v_hash);       // no stage ran
+        for (size_t b = block; b < n; b += block) v_ok = v_ok && cur[b-1] <= cur[b];
+        verify->sorted = v_ok;
+        verify->hash = v_hash;
+    }
+    if (cur != arr) memcpy(arr, cur, sizeof(int) * n);
+    free_aligned(tmp);
+}
+
+// Other key widths (--keys=double|u16|u8)
+// One template generates the iterative engine's (k, j) schedule per key type
+// (128-bit keys included) over the compare-exchange kernels of Common/bitonic_common.h, without the
+// radix and streaming kernels: strides beyond a FUSE_BLOCK take one omp for
+// per step, the rest of each stage runs fused per block.
+#define DEFINE_KEY_SORT(T, sfx)                                                             \
+void bitonic_sort_iterative_##sfx(T arr[], size_t n) {                                      \
+    size_t block = n < FUSE_BLOCK ? n : FUSE_BLOCK;                                         \
+    _Pragma("omp parallel")                                                                 \
+    {                                                                                       \
+        for (size_t k = 2; k <= n; k <<= 1) {                                               \
+            size_t j = k >> 1;                                                              \
+            for (; 2 * j > block; j >>= 1) {                                                \
+                _Pragma("omp for collapse(2) schedule(static)")                             \
+                for (size_t g = 0; g < n / (2 * j); g++) {                                  \
+                    for (size_t c = 0; c < j; c += MULTI_LEVEL_CHUNK) {                     \
+                        size_t lo = g * 2 * j + c;                                          \
+                        size_t len = j - c < MULTI_LEVEL_CHUNK ? j - c : MULTI_LEVEL_CHUNK; \
+                        compare_exchange_run_##sfx(&arr[lo], &arr[lo + j], len,             \
+                                                   ((g * 2 * j) & k) == 0);                 \
+                    }                                                                       \
+                }                                                                           \
+            }                                                                               \
+            _Pragma("omp for schedule(static)")                                             \
+            for (size_t b = 0; b < n / block; b++) {                                        \
+                for (size_t jj = j; jj > 0; jj >>= 1)                                       \
+                    for (size_t lo = b * block; lo < (b + 1) * block; lo += 2 * jj)         \
+                        compare_exchange_run_##sfx(&arr[lo], &arr[lo + jj], jj, (lo & k) == 0); \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+}
+
+DEFINE_KEY_SORT(int64_t, i64)
+DEFINE_KEY_SORT(uint16_t, u16)
+DEFINE_KEY_SORT(uint8_t, u8)
+DEFINE_KEY_SORT(key128_t, k128)
+
+// Eight-bit keys skip the network: per-thread 256-bucket histograms, bucket
+// starts, then each thread fills a static share of the output positions
+#define COUNTING_CHUNK 65536  // output bytes per fill work item
+
+void counting_sort_u8(uint8_t arr[], size_t n) {
+    size_t count[256] = { 0 }, start[257];
+    #pragma omp parallel
+    {
+        size_t local[256] = { 0 };
+        #pragma omp for schedule(static) nowait
+        for (size_t i = 0; i < n; i++) local[arr[i]]++;
+        #pragma omp critical
+        for (int v = 0; v < 256; v++) count[v] += local[v];
+        #pragma omp barrier
+        #pragma omp single
+        {
+            start[0] = 0;
+            for (int v = 0; v < 256; v++) start[v + 1] = start[v] + count[v];
+        }
+        #pragma omp for schedule(static)
+        for (size_t c = 0; c < n; c += COUNTING_CHUNK) {
+            size_t hi = n - c < COUNTING_CHUNK ? n : c + COUNTING_CHUNK;
+            int v = 0;
+            while (start[v + 1] <= c) v++;
+            for (size_t pos = c; pos < hi; v++) {
+                size_t end = start[v + 1] < hi ? start[v + 1] : hi;
+                memset(arr + pos, v, end - pos);
+                pos = end;
+            }
+        }
+    }
+    STAT_PASS(1, 2 * n);
+}
+
+// Hierarchical engine: one outer thread per NUMA domain, an inner team each
+// The array splits into D = 2^d domain blocks. An outer team (proc_bind(spread),
+// one thread per place under OMP_PLACES=sockets or numa_domains) gives every
+// domain its own block, first-touched by that domain's threads before the input
+// is written so its pages live in local memory. Each inner team (created with
+// proc_bind(close)) sorts its block ascending with the iterative schedule.
+// Only the top d merge stages cross domains: stage k starts
+// with a flip step (i against k - 1 - i, which merges two ascending runs without
+// reversing one), and every step with stride >= the block pairs exactly two
+// domains, each doing half of the pairs. All steps below the block stride stay
+// inside one domain's memory and run on its inner team alone.
+
+// a[t] against b_last[-t] ascending, t < len (flip step of two ascending runs)
+static void compare_exchange_flip(int *a, int *b_last, size_t len) {
+    STAT_PASS((size_t)(b_last - a), 2 * len);
+    for (size_t t = 0; t < len; t++) {
+        int x = a[t], y = *(b_last - t);
+        CMPX(x, y, 1);
+        a[t] = x; *(b_last - t) = y;
+    }
+}
+
+// Steps j, j/2, ..., 1 of stage k on blk[0..len) (k = 0: ascending); orphaned,
+// run by the inner team
+static void merge_block(int *blk, size_t len, size_t j, size_t k, int aligned) {
+    size_t block = len < FUSE_BLOCK ? len : FUSE_BLOCK;
+    while (2 * j > block) {
+        int levels = j / 2 > block ? 3 : j > block ? 2 : 1;
+        size_t q = j >> (levels - 1);
+        #pragma omp for collapse(2) schedule(static)
+        for (size_t g = 0; g < len / (2 * j); g++) {
+            for (size_t c = 0; c < q; c += MULTI_LEVEL_CHUNK) {
+                size_t len_c = q - c < MULTI_LEVEL_CHUNK ? q - c : MULTI_LEVEL_CHUNK;
+                large_stride_chunk(blk + g * 2 * j + c, blk + g * 2 * j + c, q, len_c, levels,
+                                   ((g * 2 * j) & k) == 0, 0);
+            }
+        }
+        j >>= levels;
+    }
+    #pragma omp for schedule(static)
+    for (size_t b = 0; b < len / block; b++) {
+        bitonic_steps_fused(blk, b * block, block, j, k, aligned);
+    }
+}
+
+// Number of domains (power of two): one per place when OMP_PLACES names sockets
+// or numa_domains (with or without a count) or lists places explicitly, else 1.
+// *source says where the count came from.
+int numa_domains(const char **source) {
+    const char *places = getenv("OMP_PLACES");
+    int by_places = places && (strncmp(places, "sockets", 7) == 0 ||
+                               strncmp(places, "numa_domains", 12) == 0 || places[0] == '{');
+    int d = by_places ? omp_get_num_places() : 1;
     int p = 1;
-    while (p < n) p <<= 1;
+    while (2 * p <= d) p <<= 1;
+    *source = by_places ? "OMP_PLACES" : places ? "OMP_PLACES has no socket/NUMA places" : "OMP_PLACES unset";
     return p;
 }
 
+// Domains actually used for n keys: halved until every block holds 2 FUSE_BLOCKs
+static int hier_domains(size_t n, int domains) {
+    while (domains > 1 && n / domains < 2 * FUSE_BLOCK) domains /= 2;
+    return domains;
+}
+
+// First touch: each domain's threads zero their own block (same outer/inner
+// teams and binding as the sort), so its pages are placed on that domain's node
+void hier_first_touch(int arr[], size_t n, int domains) {
+    domains = hier_domains(n, domains);
+    size_t B = n / domains;
+    int inner = omp_get_max_threads() / domains;
+    if (inner < 1) inner = 1;
+    int saved_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+    #pragma omp parallel num_threads(domains) proc_bind(spread)
+    {
+        int *blk = arr + (size_t)omp_get_thread_num() * B;
+        #pragma omp parallel for num_threads(inner) proc_bind(close) schedule(static)
+        for (size_t c = 0; c < B; c += MULTI_LEVEL_CHUNK)
+            memset(blk + c, 0, sizeof(int) * (B - c < MULTI_LEVEL_CHUNK ? B - c : MULTI_LEVEL_CHUNK));
+    }
+    omp_set_max_active_levels(saved_levels);
+}
+
+typedef struct {
+    int domains, inner;   // outer team size, threads per domain
+    int cross_stages;     // log2(domains) merge stages that cross domains
+} hier_stats_t;
+
+void bitonic_sort_hierarchical(int arr[], size_t n, int domains, hier_stats_t *st) {
+    domains = hier_domains(n, domains);
+    size_t B = n / domains;
+    int inner = omp_get_max_threads() / domains;
+    if (inner < 1) inner = 1;
+    int aligned = ((uintptr_t)arr % CACHE_LINE) == 0;
+    int saved_levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+    st->domains = domains;
+    st->inner = inner;
+    st->cross_stages = 0;
+    for (int d = domains; d > 1; d >>= 1) st->cross_stages++;
+
+    #pragma omp parallel num_threads(domains) proc_bind(spread)
+    {
+        size_t base = (size_t)omp_get_thread_num() * B;
+        #pragma omp parallel num_threads(inner) proc_bind(close)
+        for (size_t k = 2; k <= B; k <<= 1)
+            merge_block(arr + base, B, k >> 1, k, aligned);       // whole block, inner team
+
+        for (size_t k = 2 * B; k <= n; k <<= 1) {
+            for (size_t j = k >> 1; j >= B; j >>= 1) {    // cross-domain steps
+                #pragma omp barrier
+                int flip = j == k >> 1;
+                size_t gs = base - base % k;              // start of this k group
+                int lower = flip ? base - gs < k / 2 : base % (2 * j) < j;
+                size_t lb = lower ? base : flip ? gs + k - B - (base - gs) : base - j;
+                size_t lo = lb + (lower ? 0 : B / 2);     // our half of the pairs
+                #pragma omp parallel for num_threads(inner) proc_bind(close) schedule(static)
+                for (size_t c = 0; c < B / 2; c += MULTI_LEVEL_CHUNK) {
+                    size_t x = lo + c;
+                    size_t len = B / 2 - c < MULTI_LEVEL_CHUNK ? B / 2 - c : MULTI_LEVEL_CHUNK;
+                    if (flip) compare_exchange_flip(&arr[x], &arr[gs + k - 1 - (x - gs)], len);
+                    else compare_exchange_run(&arr[x], &arr[x + j], len, 1, aligned);
+                }
+            }
+            #pragma omp barrier
+            #pragma omp parallel num_threads(inner) proc_bind(close)
+            merge_block(arr + base, B, B >> 1, 0, aligned);   // rest stays local
+        }
+    }
+    omp_set_max_active_levels(saved_levels);
+}
+
+// Dataflow engine: block-granular tasks with depend clauses instead of taskwait
+// The array is cut into power-of-two blocks; each task names the blocks it
+// touches (by their first element) as depend(inout), so a merge step on a block
+// group starts as soon as the previous steps on those blocks are done rather
+// than waiting for a whole recursion level to join. Cross-block strides are
+// grouped three levels (8 blocks) or two levels (4 blocks) per task.
+// Every task also extends the longest dependency chain through its blocks, which
+// gives the critical path (span) next to the total work.
+#define DATAFLOW_MIN_BLOCK 4096
+#define DATAFLOW_TASKS_PER_THREAD 16
+
+typedef struct {
+    size_t block;      // elements per block
+    size_t tasks;      // tasks created
+    double work;       // summed task time (s)
+    double span;       // critical path length (s)
+} dataflow_stats_t;
+
+// Chain bookkeeping: called at the end of a task on blocks first + r*stride, r < count
+static inline void dataflow_account(double *path, size_t first, size_t stride, size_t count,
+                                    double t0, double *work) {
+    double dt = omp_get_wtime() - t0;
+    double p = 0.0;
+    for (size_t r = 0; r < count; r++) if (path[first + r * stride] > p) p = path[first + r * stride];
+    p += dt;
+    for (size_t r = 0; r < count; r++) path[first + r * stride] = p;
+    #pragma omp atomic
+    *work += dt;
+}
+
+void bitonic_sort_dataflow(int arr[], size_t n, dataflow_stats_t *st) {
+    size_t S = n;
+    size_t want = (size_t)omp_get_max_threads() * DATAFLOW_TASKS_PER_THREAD;
+    while (S / 2 >= DATAFLOW_MIN_BLOCK && n / S < want) S >>= 1;
+    size_t B = n / S;
+    int aligned = ((uintptr_t)arr % CACHE_LINE) == 0;  // blocks are multiples of a line
+
+    double *path = calloc(B, sizeof(double));
+    if (!path) { perror("calloc"); exit(1); }
+    double work = 0.0;
+    size_t tasks = 0;
+
+    #pragma omp parallel
+    #pragma omp single
+    {
+        // Stages k <= S: each block sorts itself (direction from its global index)
+        for (size_t b = 0; b < B; b++) {
+            #pragma omp task firstprivate(b) depend(inout: arr[b * S])
+            {
+                double t0 = omp_get_wtime();
+                for (size_t k = 2; k <= S; k <<= 1)
+                    bitonic_steps_fused(arr, b * S, S, k >> 1, k, aligned);
+                dataflow_account(path, b, 0, 1, t0, &work);
+            }
+            tasks++;
+        }
+        for (size_t k = 2 * S; k <= n; k <<= 1) {
+            size_t j = k >> 1;
+            // Cross-block strides, three levels per task over 8 blocks qb apart
+            for (; j / 4 >= S; j >>= 3) {
+                size_t qb = j / 4 / S;
+                for (size_t b = 0; b < B; b++) {
+                    if (b & (7 * qb)) continue;
+                    #pragma omp task firstprivate(b, qb, k) \
+                        depend(inout: arr[b * S], arr[(b + qb) * S], arr[(b + 2 * qb) * S], \
+                                      arr[(b + 3 * qb) * S], arr[(b + 4 * qb) * S], \
+                                      arr[(b + 5 * qb) * S], arr[(b + 6 * qb) * S], \
+                                      arr[(b + 7 * qb) * S])
+                    {
+                        double t0 = omp_get_wtime();
+                        compare_exchange_radix8(&arr[b * S], qb * S, S, ((b * S) & k) == 0);
+                        dataflow_account(path, b, qb, 8, t0, &work);
+                    }
+                    tasks++;
+                }
+            }
+            // Two cross-block levels left: 4 blocks per task
+            if (j / 2 >= S) {
+                size_t qb = j / 2 / S;
+                for (size_t b = 0; b < B; b++) {
+                    if (b & (3 * qb)) continue;
+                    #pragma omp task firstprivate(b, qb, k) \
+                        depend(inout: arr[b * S], arr[(b + qb) * S], arr[(b + 2 * qb) * S], \
+                                      arr[(b + 3 * qb) * S])
+                    {
+                        double t0 = omp_get_wtime();
+                        compare_exchange_radix4(&arr[b * S], qb * S, S, ((b * S) & k) == 0);
+                        dataflow_account(path, b, qb, 4, t0, &work);
+                    }
+                    tasks++;
+                }
+                j >>= 2;
+            }
+            // Last cross-block level: one task per block pair
+            for (; j >= S; j >>= 1) {
+                size_t jb = j / S;
+                for (size_t b = 0; b < B; b++) {
+                    size_t p = b ^ jb;
+                    if (p < b) continue;
+                    #pragma omp task firstprivate(b, p, k) depend(inout: arr[b * S], arr[p * S])
+                    {
+                        double t0 = omp_get_wtime();
+                        compare_exchange_run(&arr[b * S], &arr[p * S], S, ((b * S) & k) == 0, aligned);
+                        dataflow_account(path, b, p - b, 2, t0, &work);
+                    }
+                    tasks++;
+                }
+            }
+            // In-block strides: rest of stage k fused per block
+            for (size_t b = 0; b < B; b++) {
+                #pragma omp task firstprivate(b, k) depend(inout: arr[b * S])
+                {
+                    double t0 = omp_get_wtime();
+                    bitonic_steps_fused(arr, b * S, S, S >> 1, k, aligned);
+                    dataflow_account(path, b, 0, 1, t0, &work);
+                }
+                tasks++;
+            }
+        }
+    }
+
+    STAT_ADD(tasks, tasks);
+    STAT_MAX(max_depth, 1);     // all children of the single creator
+    double span = 0.0;
+    for (size_t b = 0; b < B; b++) if (path[b] > span) span = path[b];
+    free(path);
+    if (st) {
+        st->block = S;
+        st->tasks = tasks;
+        st->work = work;
+        st->span = span;
+    }
+}
+
+// Odd-even and pairwise networks (levels from Common/bitonic_common.h) run like
+// the iterative engine: one persistent team, a static omp for per level,
+// compare_exchange_run per chunk.
+// Sort with an odd-even or pairwise network; returns the comparator count
+size_t network_sort(int arr[], size_t n, int net) {
+    size_t lg = 0;
+    while (((size_t)1 << lg) < n) lg++;
+    net_level_t *lv = malloc(sizeof(net_level_t) * (lg * (lg + 1) / 2 + 1));
+    if (!lv) { perror("malloc"); exit(1); }
+    size_t levels = network_levels(net, n, lv);
+    size_t comparators = 0;
+
+    #pragma omp parallel
+    for (size_t l = 0; l < levels; l++) {
+        net_level_t v = lv[l];
+        #pragma omp for collapse(2) schedule(static) reduction(+:comparators)
+        for (size_t m = 0; m < v.R; m++) {
+            for (size_t c = 0; c < v.L; c += MULTI_LEVEL_CHUNK) {
+                size_t x = v.x0 + m * v.S + c;
+                if (v.p2 && (x - c) / v.p2 != (x - c + v.d) / v.p2) continue;
+                if (x + v.d >= n) continue;
+                size_t len = v.L - c < MULTI_LEVEL_CHUNK ? v.L - c : MULTI_LEVEL_CHUNK;
+                if (len > n - x - v.d) len = n - x - v.d;
+                compare_exchange_run(&arr[x], &arr[x + v.d], len, 1, 0);
+                comparators += len;
+            }
+        }
+    }
+    free(lv);
+    return comparators;
+}
+
+// Comparators in the bitonic network on n = 2^lg elements
+size_t bitonic_comparators(size_t n) {
+    size_t lg = 0;
+    while (((size_t)1 << lg) < n) lg++;
+    return n / 2 * (lg * (lg + 1) / 2);
+}
+
+// Adaptive engine, task-parallel: the bitonic tree of Common/bitonic_common.h
+// The two recursive sorts and the two sub-merges after a half-cleaner walk are
+// independent, so they become tasks above ADAPTIVE_TASK_MIN nodes.
+#define ADAPTIVE_TASK_MIN 16384
+
+// Merge the bitonic sequence (subtree of root, then spare) in direction up
+void adaptive_merge(abtree_t *t, uint32_t root, uint32_t spare, size_t size, int up) {
+    STAT_PARENT;
+    adaptive_half_clean(t, root, spare, up);
+    if (t->left[root] == AB_NIL) return;
+    uint32_t l = t->left[root], r = t->right[root];
+    size_t half = (size - 1) / 2;
+    if (size > ADAPTIVE_TASK_MIN) {
+        #pragma omp task
+        STAT_TASK(adaptive_merge(t, l, root, half, up));
+        adaptive_merge(t, r, spare, half, up);
+        #pragma omp taskwait
+    } else {
+        adaptive_merge(t, l, root, half, up);
+        adaptive_merge(t, r, spare, half, up);
+    }
+}
+
+void adaptive_sort_tree(abtree_t *t, uint32_t root, uint32_t spare, int up) {
+    STAT_PARENT;
+    size_t size = ab_size(root);
+    if (size + 1 <= ADAPTIVE_BLOCK) return;   // block pre-sorted by the network
+    if (t->left[root] == AB_NIL) {
+        adaptive_half_clean(t, root, spare, up);
+        return;
+    }
+    if (size > ADAPTIVE_TASK_MIN) {
+        #pragma omp task
+        STAT_TASK(adaptive_sort_tree(t, t->left[root], root, up));
+        adaptive_sort_tree(t, t->right[root], spare, !up);
+        #pragma omp taskwait
+    } else {
+        adaptive_sort_tree(t, t->left[root], root, up);
+        adaptive_sort_tree(t, t->right[root], spare, !up);
+    }
+    adaptive_merge(t, root, spare, size, up);
+}
+
+// Write the subtree of root (size nodes, complete shape) in in-order to out
+static void adaptive_emit(const abtree_t *t, uint32_t root, size_t size, int *out) {
+    STAT_PARENT;
+    if (root == AB_NIL) return;
+    size_t half = (size - 1) / 2;
+    out[half] = ab_value(t->key[root]);
+    if (size > ADAPTIVE_TASK_MIN) {
+        #pragma omp task
+        STAT_TASK(adaptive_emit(t, t->left[root], half, out));
+        adaptive_emit(t, t->right[root], half, out + half + 1);
+        #pragma omp taskwait
+    } else {
+        adaptive_emit(t, t->left[root], half, out);
+        adaptive_emit(t, t->right[root], half, out + half + 1);
+    }
+}
+
+// Sort arr[0..n) ascending (n a power of two, 2 <= n <= 2^32); 0 on success
+int bitonic_sort_adaptive(int arr[], size_t n) {
+    abtree_t t;
+    if (abtree_alloc(&t, n) != 0) return -1;
+    size_t C = n < ADAPTIVE_BLOCK ? n : ADAPTIVE_BLOCK;
+    uint32_t root = (uint32_t)(n / 2 - 1);
+    int aligned = ((uintptr_t)arr % CACHE_LINE) == 0;
+
+    #pragma omp parallel
+    {
+        // Bottom levels: fused iterative steps per block (ascending iff lo & C is
+        // clear, the direction the tree recursion expects), then build the tree
+        #pragma omp for schedule(static)
+        for (size_t lo = 0; lo < n; lo += C)
+            for (size_t k = 2; k <= C; k <<= 1)
+                bitonic_steps_fused(arr, lo, C, k >> 1, k, aligned);
+        #pragma omp for schedule(static)
+        for (size_t i = 0; i < n; i++) abtree_node(&t, arr, i, n, C);
+        #pragma omp single
+        {
+            adaptive_sort_tree(&t, root, (uint32_t)(n - 1), 1);
+            adaptive_emit(&t, root, n - 1, arr);   // swaps keep the tree complete
+        }
+    }
+    arr[n - 1] = ab_value(t.key[n - 1]);
+
+    abtree_free(&t);
+    return 0;
+}
+
+// Automatic thread count
+// A thread only pays for its wake-up and barriers if it gets enough keys, and
+// once the array spills out of the last-level cache the large strides are
+// bound by memory bandwidth, so threads past the point where bandwidth stops
+// growing just queue on the bus. The policy takes the smallest of: the CPUs we
+// may use (online cores, capped by a cgroup CPU quota), n / KEYS_PER_THREAD,
+// and - for arrays beyond the LLC - the thread count where a short copy probe
+// stops gaining more than BW_GAIN_MIN.
+#define KEYS_PER_THREAD 32768
+#define BW_PROBE_BYTES ((size_t)64 << 20)
+#define BW_GAIN_MIN 1.10
+
+// CPU quota of this container in whole CPUs (rounded up), 0 when unlimited
+int cgroup_cpu_limit(void) {
+    long long quota = -1, period = 0;
+    FILE *f = fopen("/sys/fs/cgroup/cpu.max", "r");            // cgroup v2
+    if (f) {
+        char q[32];
+        if (fscanf(f, "%31s %lld", q, &period) == 2 && strcmp(q, "max") != 0) quota = atoll(q);
+        fclose(f);
+    } else if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r"))) {   // cgroup v1
+        if (fscanf(f, "%lld", &quota) != 1) quota = -1;
+        fclose(f);
+        if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r"))) {
+            if (fscanf(f, "%lld", &period) != 1) period = 0;
+            fclose(f);
+        }
+    }
+    if (quota <= 0 || period <= 0) return 0;
+    return (int)((quota + period - 1) / period);
+}
+
+// Copy bandwidth (GB/s, read + write) of threads threads over src -> dst
+static double bandwidth_probe(int *dst, const int *src, size_t n, int threads) {
+    double t0 = omp_get_wtime();
+    #pragma omp parallel for num_threads(threads) schedule(static)
+    for (size_t i = 0; i < n; i++) dst[i] = src[i];
+    return 2.0 * sizeof(int) * (double)n / (omp_get_wtime() - t0) / 1e9;
+}
+
+typedef struct {
+    int cpus;          // online cores, after the cgroup quota
+    int quota;         // cgroup CPU limit, 0 = none
+    int by_size;       // n / KEYS_PER_THREAD
+    int by_bandwidth;  // saturation point of the probe, 0 = not probed
+    double gbps;       // probe bandwidth at that point
+} thread_policy_t;
+
+// Thread count for sorting m keys
+int auto_threads(size_t m, thread_policy_t *tp) {
+    memset(tp, 0, sizeof(*tp));
+    tp->cpus = omp_get_num_procs();
+    tp->quota = cgroup_cpu_limit();
+    if (tp->quota > 0 && tp->quota < tp->cpus) tp->cpus = tp->quota;
+    size_t s = m / KEYS_PER_THREAD;
+    tp->by_size = s < 1 ? 1 : s > (size_t)tp->cpus ? tp->cpus : (int)s;
+    int threads = tp->by_size;
+
+    if (threads > 1 && sizeof(int) * m > llc_bytes()) {
+        size_t n = BW_PROBE_BYTES / sizeof(int);
+        int *src = aligned_buffer(BW_PROBE_BYTES), *dst = aligned_buffer(BW_PROBE_BYTES);
+        if (src && dst) {
+            memset(src, 1, BW_PROBE_BYTES);
+            memset(dst, 0, BW_PROBE_BYTES);   // fault the pages in before timing
+            int best = 1;
+            double bw = bandwidth_probe(dst, src, n, 1);
+            for (int p = 2; p <= threads; p = p * 2 > threads && p < threads ? threads : p * 2) {
+                double b = bandwidth_probe(dst, src, n, p);
+                if (b < bw * BW_GAIN_MIN) break;
+                best = p;
+                bw = b;
+            }
+            tp->by_bandwidth = best;
+            tp->gbps = bw;
+            threads = best;
+        }
+        free_aligned(src);
+        free_aligned(dst);
+    }
+    return threads;
+}
+
+// Memory bandwidth roofline (--roofline)
+// A STREAM-like triad (a = b + 3c, 12 bytes per element, best of
+// TRIAD_REPS) gives the sustainable bandwidth at 1, 2, 4, ... threads. A sort
+// that leaves the cache moves 2 * sizeof(int) bytes per key for every sweep
+// over the array, and the sweep count is fixed by the network and the engine's
+// fusion, so achieved GB/s against the triad at the same thread count says
+// whether a run is memory-bound or limited by compute and task overhead.
+#define TRIAD_REPS 5
+#define TRIAD_MIN_BYTES ((size_t)64 << 20)    // per array
+#define TRIAD_MAX_BYTES ((size_t)256 << 20)
+#define ROOFLINE_MEMORY_BOUND 0.7             // fraction of the triad
+
+typedef struct {
+    int threads[32];
+    double gbps[32];
+    int count;
+    size_t bytes;      // per array
+} triad_t;
+
+// Triad bandwidth at 1, 2, 4, ..., max_threads threads (max_threads last)
+void triad_sweep(int max_threads, triad_t *tr) {
+    size_t bytes = 2 * llc_bytes();
+    if (bytes < TRIAD_MIN_BYTES) bytes = TRIAD_MIN_BYTES;
+    if (bytes > TRIAD_MAX_BYTES) bytes = TRIAD_MAX_BYTES;
+    size_t n = bytes / sizeof(int);
+    int *a = aligned_buffer(bytes), *b = aligned_buffer(bytes), *c = aligned_buffer(bytes);
+    tr->count = 0;
+    tr->bytes = bytes;
+    if (!a || !b || !c) {
+        free_aligned(a); free_aligned(b); free_aligned(c);
+        return;
+    }
+    for (int p = 1; tr->count < 32; p = p * 2 > max_threads && p < max_threads ? max_threads : p * 2) {
+        if (p > max_threads) break;
+        #pragma omp parallel for num_threads(p) schedule(static)   // first touch per team
+        for (size_t i = 0; i < n; i++) { a[i] = 0; b[i] = (int)i; c[i] = 1; }
+        double best = 0.0;
+        for (int r = 0; r < TRIAD_REPS; r++) {
+            double t0 = omp_get_wtime();
+            #pragma omp parallel for num_threads(p) schedule(static)
+            for (size_t i = 0; i < n; i++) a[i] = b[i] + 3 * c[i];
+            double gbps = 3.0 * bytes / (omp_get_wtime() - t0) / 1e9;
+            if (gbps > best) best = gbps;
+        }
+        tr->threads[tr->count] = p;
+        tr->gbps[tr->count++] = best;
+        if (p == max_threads) break;
+    }
+    free_aligned(a); free_aligned(b); free_aligned(c);
+}
+
+// Sweeps over the whole array made by the iterative engine on n keys
+size_t iterative_sweeps(size_t n) {
+    size_t block = n < FUSE_BLOCK ? n : FUSE_BLOCK, sweeps = 0;
+    for (size_t k = 2; k <= n; k <<= 1) {
+        size_t j = k >> 1;
+        while (2 * j > block) {
+            int levels = j / 2 > block ? 3 : j > block ? 2 : 1;
+            sweeps++;
+            j >>= levels;
+        }
+        sweeps++;   // fused small strides
+    }
+    return sweeps;
+}
+
+// Sweeps that reach memory in the recursive engines (depth-first) on n keys:
+// everything up to cache-sized subsorts is one sweep, then per larger stage one
+// sweep per out-of-cache merge step (radix-8 above MULTI_LEVEL_MIN) plus one
+size_t recursive_sweeps(size_t n, size_t cache_keys) {
+    size_t sweeps = 1;
+    for (size_t k = 2 * cache_keys; k <= n; k <<= 1) {
+        for (size_t cnt = k; cnt > cache_keys; cnt /= cnt > MULTI_LEVEL_MIN ? 8 : 2) sweeps++;
+        sweeps++;
+    }
+    return sweeps;
+}
+
+// Engine picked in main
+typedef struct {
+    int small, adaptive, iterative, dataflow, net, streaming;
+    int hier, domains;
+} engine_t;
+
+// Sort the padded array; returns the comparator count (0 when not a fixed network)
+// verify is passed on to the iterative engine's fused final pass (may be NULL)
+size_t sort_padded(int arr[], size_t m, const engine_t *e, sweep_stats_t *sweeps,
+                   dataflow_stats_t *df, hier_stats_t *hs, verify_t *verify) {
+    if (e->small) { bitonic_sort_small(arr, m); return bitonic_comparators(m); }
+    if (e->net != NET_BITONIC) return network_sort(arr, m, e->net);
+    if (e->adaptive && bitonic_sort_adaptive(arr, m) == 0) return 0;
+    if (e->hier) bitonic_sort_hierarchical(arr, m, e->domains, hs);
+    else if (e->iterative) bitonic_sort_iterative(arr, m, e->streaming, sweeps, verify);
+    else if (e->dataflow) bitonic_sort_dataflow(arr, m, df);
+    else bitonic_sort_parallel(arr, m);
+    return bitonic_comparators(m);
+}
+
+// Key-type modes: key maps and padding from Common/bitonic_common.h around the
+// iterative schedules; eight-bit keys take the counting sort unless --counting=off
+size_t sort_f32(int arr[], size_t n, size_t m, const engine_t *e, sweep_stats_t *sweeps,
+                dataflow_stats_t *df, hier_stats_t *hs) {
+    f32_to_keys(arr, n, m);
+    size_t comparators = sort_padded(arr, m, e, sweeps, df, hs, NULL);
+    f32_from_keys(arr, n);
+    return comparators;
+}
+
+size_t sort_f64(int64_t arr[], size_t n, size_t m) {
+    f64_to_keys(arr, n, m);
+    bitonic_sort_iterative_i64(arr, m);
+    f64_from_keys(arr, n);
+    return bitonic_comparators(m);
+}
+
+size_t sort_k128(key128_t arr[], size_t n, size_t m) {
+    pad_k128(arr, n, m);
+    bitonic_sort_iterative_k128(arr, m);
+    return bitonic_comparators(m);
+}
+
+size_t sort_u16(uint16_t arr[], size_t n, size_t m) {
+    pad_u16(arr, n, m);
+    bitonic_sort_iterative_u16(arr, m);
+    return bitonic_comparators(m);
+}
+
+size_t sort_u8(uint8_t arr[], size_t n, size_t m, int counting) {
+    if (counting) {
+        counting_sort_u8(arr, n);
+        return 0;
+    }
+    pad_u8(arr, n, m);
+    bitonic_sort_iterative_u8(arr, m);
+    return bitonic_comparators(m);
+}
+
+// One latency_bench sort with engine e (ctx)
+static void latency_sort(int arr[], size_t m, const void *ctx) {
+    dataflow_stats_t df;
+    hier_stats_t hs;
+    sort_padded(arr, m, (const engine_t *)ctx, NULL, &df, &hs, NULL);
+}
+
+// Kernel microbenchmarks (--microbench[=FILE], JSON)
+// Each case times one piece of the sort in isolation: the compare-exchange
+// kernel per stride and alignment, one merge level (plain and radix-8, single
+// thread and team), the base-case networks, padding setup, and the cost of a
+// parallel region and of a task. The kernels are branch-free and the network
+// is data-oblivious, so a case reruns on its own output and every call does
+// the same work. Each result is the median of MB_SAMPLES samples.
+#define MB_SAMPLES 7
+#define MB_MIN_SECS 0.002   // per sample; the call count doubles until reached
+
+typedef struct {
+    int *a;
+    size_t n, stride, len;
+    int aligned;
+} mb_ctx_t;
+
+typedef void (*mb_fn_t)(mb_ctx_t *);
+
+// Median seconds per call of fn
+static double mb_time(mb_fn_t fn, mb_ctx_t *c) {
+    size_t calls = 1;
+    for (;;) {
+        double t0 = omp_get_wtime();
+        for (size_t i = 0; i < calls; i++) fn(c);
+        if (omp_get_wtime() - t0 >= MB_MIN_SECS) break;
+        calls *= 2;
+    }
+    double s[MB_SAMPLES];
+    for (int k = 0; k < MB_SAMPLES; k++) {
+        double t0 = omp_get_wtime();
+        for (size_t i = 0; i < calls; i++) fn(c);
+        s[k] = (omp_get_wtime() - t0) / calls;
+    }
+    qsort(s, MB_SAMPLES, sizeof(double), compare_double);
+    return s[MB_SAMPLES / 2];
+}
+
+static void mb_cmpx(mb_ctx_t *c) { compare_exchange_run(c->a, c->a + c->stride, c->len, 1, c->aligned); }
+
+static void mb_level(mb_ctx_t *c) {
+    for (size_t lo = 0; lo < c->n; lo += 2 * c->stride)
+        compare_exchange_run(c->a + lo, c->a + lo + c->stride, c->stride, 1, c->stride % VEC_INTS == 0);
+}
+
+static void mb_level_team(mb_ctx_t *c) {
+    size_t j = c->stride;
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (size_t lo = 0; lo < c->n; lo += 2 * j) {
+        for (size_t t = 0; t < j; t += MULTI_LEVEL_CHUNK) {
+            size_t len = j - t < MULTI_LEVEL_CHUNK ? j - t : MULTI_LEVEL_CHUNK;
+            compare_exchange_run(c->a + lo + t, c->a + lo + j + t, len, 1, len % VEC_INTS == 0);
+        }
+    }
+}
+
+static void mb_radix8(mb_ctx_t *c) {   // three levels, operands stride apart
+    for (size_t lo = 0; lo < c->n; lo += 8 * c->stride)
+        compare_exchange_radix8(c->a + lo, c->stride, c->stride, 1);
+}
+
+static void mb_sort8(mb_ctx_t *c) {
+    for (size_t lo = 0; lo < c->n; lo += 8) sort8(c->a + lo, (lo & 8) == 0);
+}
+
+static void mb_small(mb_ctx_t *c) { bitonic_sort_small(c->a, c->n); }
+
+static void mb_padding(mb_ctx_t *c) {
+    size_t m = next_power_of_two(c->n);
+    for (size_t i = c->n; i < m; i++) c->a[i] = INT_MAX;
+}
+
+static void mb_region(mb_ctx_t *c) {
+    #pragma omp parallel
+    {
+        if (omp_get_thread_num() == 0) c->a[0]++;
+    }
+}
+
+static void mb_tasks(mb_ctx_t *c) {
+    #pragma omp parallel
+    #pragma omp single
+    {
+        for (size_t i = 0; i < c->n; i++) {
+            #pragma omp task
+            c->a[1 + i % 64]++;
+        }
+        #pragma omp taskwait
+    }
+}
+
+// One JSON record; keys and bytes are per call (0 = not meaningful)
+static void mb_emit(FILE *f, int *first, const char *name, size_t n, size_t stride,
+                    size_t align, double secs, double keys, double bytes) {
+    fprintf(f, "%s\n    {\"name\": \"%s\", \"n\": %zu, \"stride\": %zu, \"align\": %zu, "
+               "\"ns\": %.1f", *first ? "" : ",", name, n, stride, align, secs * 1e9);
+    if (keys > 0) fprintf(f, ", \"ns_per_key\": %.4f", secs * 1e9 / keys);
+    if (bytes > 0) fprintf(f, ", \"gbps\": %.3f", bytes / secs / 1e9);
+    fprintf(f, "}");
+    *first = 0;
+}
+
+// Run every case and write one JSON document to path (stdout when NULL)
+int microbench(const char *path) {
+    const size_t max_n = (size_t)1 << 24;
+    int *buf = aligned_buffer(sizeof(int) * (max_n + 64));
+    if (!buf) {
+        perror("aligned_buffer");
+        return 1;
+    }
+    for (size_t i = 0; i < max_n + 64; i++) buf[i] = rand();
+    FILE *f = path ? fopen(path, "w") : stdout;
+    if (!f) {
+        perror(path);
+        free_aligned(buf);
+        return 1;
+    }
+    fprintf(f, "{\n  \"suite\": \"bitonicOmp02\",\n  \"threads\": %d,\n  \"vec_ints\": %d,\n  \"results\": [",
+            omp_get_max_threads(), VEC_INTS);
+    int first = 1;
+    mb_ctx_t c;
+    double s;
+
+    // Compare-exchange kernel: one run of up to 4096 pairs, offset by align ints
+    static const size_t aligns[] = { 0, 1, 3 };
+    for (size_t j = 1; j <= ((size_t)1 << 20); j <<= 2) {
+        for (int k = 0; k < 3; k++) {
+            c = (mb_ctx_t){ buf + aligns[k], 0, j, j < 4096 ? j : 4096, aligns[k] == 0 };
+            s = mb_time(mb_cmpx, &c);
+            mb_emit(f, &first, "compare_exchange", c.len, j, aligns[k] * sizeof(int), s,
+                    2.0 * c.len, 4.0 * sizeof(int) * c.len);
+        }
+    }
+    // One merge level (and three per sweep with radix-8) over n keys
+    for (size_t n = (size_t)1 << 16; n <= max_n; n <<= 4) {
+        for (size_t j = 1; j < n; j <<= 3) {
+            c = (mb_ctx_t){ buf, n, j, 0, 1 };
+            s = mb_time(mb_level, &c);
+            mb_emit(f, &first, "merge_level", n, j, 0, s, n, 2.0 * sizeof(int) * n);
+            if (j >= MULTI_LEVEL_CHUNK && j < n) {
+                s = mb_time(mb_level_team, &c);
+                mb_emit(f, &first, "merge_level_team", n, j, 0, s, n, 2.0 * sizeof(int) * n);
+            }
+            if (8 * j <= n) {
+                s = mb_time(mb_radix8, &c);
+                mb_emit(f, &first, "merge_level_radix8", n, j, 0, s / 3, n, 2.0 * sizeof(int) * n / 3);
+            }
+        }
+    }
+    // Base-case networks
+    c = (mb_ctx_t){ buf, SMALL_SORT_MAX, 0, 0, 1 };
+    s = mb_time(mb_sort8, &c);
+    mb_emit(f, &first, "sort8", SMALL_SORT_MAX, 0, 0, s, SMALL_SORT_MAX, 0);
+    for (size_t n = 8; n <= SMALL_SORT_MAX; n <<= 1) {
+        c = (mb_ctx_t){ buf, n, 0, 0, 1 };
+        s = mb_time(mb_small, &c);
+        mb_emit(f, &first, "sort_small", n, 0, 0, s, n, 0);
+    }
+    // Padding setup for the worst case n = 2^k + 1
+    for (size_t n = ((size_t)1 << 10) + 1; n < max_n; n = (n - 1) * 16 + 1) {
+        c = (mb_ctx_t){ buf, n, 0, 0, 1 };
+        s = mb_time(mb_padding, &c);
+        mb_emit(f, &first, "padding", n, 0, 0, s, 0, sizeof(int) * (next_power_of_two(n) - n));
+    }
+    // Team wake-up and task spawn overhead
+    c = (mb_ctx_t){ buf, 0, 0, 0, 1 };
+    s = mb_time(mb_region, &c);
+    mb_emit(f, &first, "parallel_region", 0, 0, 0, s, 0, 0);
+    c.n = 1024;
+    s = mb_time(mb_tasks, &c);
+    mb_emit(f, &first, "task_spawn", c.n, 0, 0, s / c.n, 0, 0);
+
+    fprintf(f, "\n  ]\n}\n");
+    if (path) fclose(f);
+    free_aligned(buf);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    int n = 1024;
+    size_t n = 1024;
     int num_threads = omp_get_max_threads();
+
+    // Positional arguments are n and num_threads; options start with "--"
+    const char *pos[2] = { NULL, NULL };
+    int npos = 0;
+    const char *engine = "auto";    // --engine=auto|tasks|iterative|dataflow|oddeven|pairwise|adaptive|hier
+    const char *stream = "auto";    // --stream=auto|on|off (iterative engine)
+    int latency_reps = 0;           // --latency=REPS: p50/p99 over REPS sorts
+    int small = 1;                  // --small=off: no small-input fast path
+    int domains = 0;                // --domains=D for the hier engine (0 = from OMP_PLACES)
+    int fused_verify = 1;           // --verify=fused|pass: fold into the final pass if possible
+    const char *bench_json = NULL;  // --microbench[=FILE]: kernel microbenchmarks as JSON
+    int bench = 0;
+    int roofline = 0;               // --roofline: triad bandwidth and fraction achieved
+    int energy = 0;                 // --energy: RAPL joules per phase
+    const char *keys = "int";       // --keys=int|float|double|u16|u8|uuid|pair
+    int counting = 1;               // --counting=off: u8 keys through the network
+    for (int a = 1; a < argc; a++) {
+        if (strncmp(argv[a], "--engine=", 9) == 0) engine = argv[a] + 9;
+        else if (strncmp(argv[a], "--stream=", 9) == 0) stream = argv[a] + 9;
+        else if (strncmp(argv[a], "--latency=", 10) == 0) latency_reps = atoi(argv[a] + 10);
+        else if (strncmp(argv[a], "--small=", 8) == 0) small = strcmp(argv[a] + 8, "off") != 0;
+        else if (strncmp(argv[a], "--domains=", 10) == 0) domains = atoi(argv[a] + 10);
+        else if (strncmp(argv[a], "--verify=", 9) == 0) fused_verify = strcmp(argv[a] + 9, "pass") != 0;
+        else if (strcmp(argv[a], "--microbench") == 0) bench = 1;
+        else if (strcmp(argv[a], "--roofline") == 0) roofline = 1;
+        else if (strcmp(argv[a], "--energy") == 0) energy = 1;
+        else if (strncmp(argv[a], "--keys=", 7) == 0) keys = argv[a] + 7;
+        else if (strncmp(argv[a], "--counting=", 11) == 0) counting = strcmp(argv[a] + 11, "off") != 0;
+        else if (strncmp(argv[a], "--microbench=", 13) == 0) { bench = 1; bench_json = argv[a] + 13; }
+        else if (strncmp(argv[a], "--", 2) == 0) {
+            printf("Unknown option '%s'.\n", argv[a]);
+            printf("Usage: %s [n] [num_threads|auto] [--engine=auto|tasks|iterative|dataflow|oddeven|pairwise|adaptive|hier] "
+                   "[--stream=auto|on|off] [--latency=REPS] [--small=off] [--domains=D] [--verify=fused|pass] "
+                   "[--microbench[=FILE]] [--roofline] [--energy] [--keys=int|float|double|u16|u8|uuid|pair] "
+                   "[--counting=off]\n", argv[0]);
+            return 1;
+        }
+        else if (npos < 2) pos[npos++] = argv[a];
+    }
+    int autosel = strcmp(engine, "auto") == 0;
+    int adaptive = strcmp(engine, "adaptive") == 0;
+    int iterative = strcmp(engine, "iterative") == 0 || autosel;
+    int dataflow = strcmp(engine, "dataflow") == 0;
+    int hier = strcmp(engine, "hier") == 0;
+    int net = strcmp(engine, "oddeven") == 0 ? NET_ODDEVEN :
+              strcmp(engine, "pairwise") == 0 ? NET_PAIRWISE : NET_BITONIC;
+    if (!iterative && !dataflow && !adaptive && !hier && net == NET_BITONIC && strcmp(engine, "tasks") != 0) {
+        printf("Unknown engine '%s' (use tasks, iterative, dataflow, oddeven, pairwise, adaptive, hier or auto).\n", engine);
+        return 1;
+    }
+    int kt = parse_key_type(keys);
+    int wide = kt == KEYS_UUID || kt == KEYS_PAIR;
+    if (kt < 0) {
+        printf("Unknown key type '%s' (int, float, double, u16, u8, uuid or pair).\n", keys);
+        return 1;
+    }
     
-    if (argc > 1) n = atoi(argv[1]);
-    // Set thread count
-    if (argc > 2) {
-        num_threads = atoi(argv[2]);
+    if (npos > 0) {
+        long long v = atoll(pos[0]);
+        n = v > 0 ? (size_t)v : 0;
+    }
+    // Set thread count; "auto" (or no count and no OMP_NUM_THREADS) picks it from n
+    int threads_auto = npos > 1 ? strcmp(pos[1], "auto") == 0 : getenv("OMP_NUM_THREADS") == NULL;
+    if (npos > 1 && !threads_auto) {
+        num_threads = atoi(pos[1]);
         omp_set_num_threads(num_threads);
     }
+    if (bench) return microbench(bench_json);
     
-    if (n <= 0) {
+    if (n == 0) {
         printf("Number of elements must be positive.\n");
         return 1;
     }
 
-    int m = next_power_of_two(n);
-    int *arr = malloc(sizeof(int) * m);
-    if (!arr) {
-        perror("malloc");
-        return 1;
+    size_t m = next_power_of_two(n);
+
+    if (adaptive && (m < 2 || m > ((size_t)1 << 32))) { adaptive = 0; iterative = 1; }
+    // Small inputs on the default, iterative and auto engines never wake the team
+    small = small && m <= SMALL_SORT_MAX && !adaptive && !dataflow && !hier && net == NET_BITONIC;
+    if (small) iterative = 0;
+
+    thread_policy_t tp;
+    if (threads_auto) {
+        num_threads = small ? 1 : auto_threads(m, &tp);
+        omp_set_num_threads(num_threads);
     }
 
+    // Streaming pays off once the array no longer fits in the last-level cache and
+    // several threads share the memory bus (one thread is compute-bound). This is
+    // where auto's engine setup sees the core count and bandwidth probe: through
+    // the thread count they chose, not through a separate engine threshold.
+    int streaming = strcmp(stream, "on") == 0 ||
+                    (strcmp(stream, "auto") == 0 && sizeof(int) * m > llc_bytes() &&
+                     omp_get_max_threads() > 1);
+    const char *domain_source = "--domains";
+    if (domains < 1) domains = numa_domains(&domain_source);
+    engine_t eng = { small, adaptive, iterative, dataflow, net, streaming, hier, domains };
+
     srand(42);
-    for (int i = 0; i < n; i++) {
-        arr[i] = rand() % 10000;
+    if (latency_reps > 0) {
+        int ok = latency_bench(n, m, latency_reps, NULL, latency_sort, &eng);
+        printf("Result: %s\n", ok ? "SORTED" : "NOT SORTED");
+        return 0;
+    }
+
+    size_t width = key_width(kt);
+    int *arr = aligned_buffer(width * m);
+    if (!arr) {
+        perror("aligned_buffer");
+        return 1;
     }
-    for (int i = n; i < m; i++) arr[i] = INT_MAX;
 
-    printf("OpenMP Bitonic Sort (Task-based) - Array size: %d, Threads: %d\n", n, num_threads);
+    // The hier engine sorts each domain block on that domain: place its pages
+    // there before the (single-threaded) fill below touches them
+    if (hier && width == sizeof(int)) hier_first_touch(arr, m, domains);
+    uint64_t in_hash = fill_keys(kt, arr, n, m);
+
+    const char *title = small ? "Small-input" : hier ? "Hierarchical" : adaptive ? "Adaptive" :
+                        iterative ? "Iterative" : dataflow ? "Dataflow" : net == NET_ODDEVEN ? "Odd-even merge" :
+                        net == NET_PAIRWISE ? "Pairwise" : "Task-based";
+    if (kt == KEYS_DOUBLE) title = "Iterative, 64-bit keys";
+    else if (kt == KEYS_U16) title = "Iterative, 16-bit keys";
+    else if (kt == KEYS_U8) title = counting ? "Counting sort, 8-bit keys" : "Iterative, 8-bit keys";
+    else if (wide) title = "Iterative, 128-bit keys";
+    printf("OpenMP Bitonic Sort (%s) - Array size: %zu, Threads: %d\n", title, n, num_threads);
+    print_keys(kt, keys, counting);
+    if (threads_auto && !small) {
+        printf("Auto threads: %d CPUs%s, size cap %d", tp.cpus, tp.quota ? " (cgroup quota)" : "", tp.by_size);
+        if (tp.by_bandwidth) printf(", bandwidth cap %d (%.1f GB/s)", tp.by_bandwidth, tp.gbps);
+        printf("\n");
+    }
+    if (autosel && !small)
+        printf("Auto engine: iterative, streaming %s\n", !streaming ? "off" :
+               strcmp(stream, "on") == 0 ? "on (--stream=on)" : "on (array > LLC, several threads)");
     
+    triad_t tr;
+    if (roofline) {
+        triad_sweep(omp_get_max_threads(), &tr);
+        printf("Triad (%zu MB arrays):", tr.bytes >> 20);
+        for (int i = 0; i < tr.count; i++) printf(" %d thr %.1f GB/s%s", tr.threads[i], tr.gbps[i],
+                                                  i + 1 < tr.count ? "," : "");
+        printf("\n");
+    }
+
+    sweep_stats_t sweeps[64];
+    memset(sweeps, 0, sizeof(sweeps));
+
+    dataflow_stats_t df;
+    hier_stats_t hs;
+    verify_t v;
+    int fused = fused_verify && iterative && kt == KEYS_INT;
+    rapl_t rapl;
+    rapl_sample_t e0, e1, e2;
+    if (energy && !rapl_open(&rapl)) printf("Energy: RAPL counters not readable under %s\n", RAPL_ROOT);
+    if (energy) rapl_read(&rapl, &e0);
+#ifdef SORT_STATS
+    sort_stats_reset();
+#endif
     double start_time = omp_get_wtime();
-    bitonic_sort_parallel(arr, m);
+    size_t comparators = kt == KEYS_DOUBLE ? sort_f64((int64_t *)arr, n, m) :
+                         kt == KEYS_U16 ? sort_u16((uint16_t *)arr, n, m) :
+                         kt == KEYS_U8 ? sort_u8((uint8_t *)arr, n, m, counting) :
+                         wide ? sort_k128((key128_t *)arr, n, m) :
+                         kt == KEYS_FLOAT ? sort_f32(arr, n, m, &eng, sweeps, &df, &hs) :
+                         sort_padded(arr, m, &eng, sweeps, &df, &hs, fused ? &v : NULL);
     double end_time = omp_get_wtime();
+    if (energy) rapl_read(&rapl, &e1);
     
     double execution_time = end_time - start_time;
     printf("Execution time: %.6f seconds\n", execution_time);
-    
-    // Check if sorted correctly
-    int sorted = 1;
-    for (int i = 1; i < n; i++) {
-        if (arr[i-1] > arr[i]) {
-            sorted = 0;
-            break;
+    if (comparators) printf("Comparators: %zu\n", comparators);
+    if (iterative) {
+        for (int lg = 63; lg >= 0; lg--) {
+            if (!sweeps[lg].sweeps) continue;
+            printf("  stride 2^%d x%d levels (%s): %zu sweeps, %.2f GB/s\n", lg, sweeps[lg].levels,
+                   streaming ? "streaming" : "in place", sweeps[lg].sweeps,
+                   sweeps[lg].bytes / sweeps[lg].secs / 1e9);
         }
     }
-    printf("Result: %s\n", sorted ? "SORTED" : "NOT SORTED");
+    if (dataflow) {
+        printf("Dataflow: %zu tasks on %zu-element blocks, work %.6f s, critical path %.6f s, parallelism %.1f\n",
+               df.tasks, df.block, df.work, df.span, df.span > 0 ? df.work / df.span : 0.0);
+    }
+    if (hier) {
+        printf("Hierarchical: %d domains (%s%s) x %d threads, %d cross-domain merge stages%s\n",
+               hs.domains, domain_source, hs.domains < domains ? ", fewer for this n" : "",
+               hs.inner, hs.cross_stages, hs.domains == 1 ? " (one domain: plain iterative schedule)" : "");
+    }
+#ifdef SORT_STATS
+    sort_stats_t stats;
+    sort_stats_get(&stats);
+    sort_stats_print(&stats, m, 0);
+#endif
+    if (roofline) {
+        // Iterative and hierarchical engines sweep the whole array per step; the
+        // task and dataflow engines recurse depth-first; other networks not modeled
+        size_t cache_keys = llc_bytes() / sizeof(int);
+        size_t passes = iterative || hier ? iterative_sweeps(m) :
+                        !small && !adaptive && net == NET_BITONIC ? recursive_sweeps(m, cache_keys) : 0;
+        double roof = tr.count ? tr.gbps[tr.count - 1] : 0.0;
+        if (m <= cache_keys) {
+            printf("Roofline: %zu keys fit in the LLC; the run is not memory-bound\n", m);
+        } else if (!passes || roof <= 0.0) {
+            printf("Roofline: not modeled for this engine\n");
+        } else {
+            double bytes = 2.0 * sizeof(int) * (double)passes * (double)m;
+            double gbps = bytes / execution_time / 1e9;
+            printf("Roofline: %zu sweeps, %.0f bytes/key, %.2f GB/s achieved = %.0f%% of triad at %d threads (%s)\n",
+                   passes, bytes / m, gbps, 100.0 * gbps / roof, tr.threads[tr.count - 1],
+                   gbps >= ROOFLINE_MEMORY_BOUND * roof ? "memory-bound" : "compute/overhead-bound");
+        }
+    }
+    
+    // Check order and that the output is a permutation of the input
+    if (fused) {
+        printf("Verify: fused into the final pass\n");
+    } else {
+        double t_verify = omp_get_wtime();
+        verify_keys(kt, arr, n, m, &v);
+        printf("Verify: %.6f seconds\n", omp_get_wtime() - t_verify);
+    }
+    if (energy) {
+        char phase[96];
+        rapl_read(&rapl, &e2);
+        snprintf(phase, sizeof(phase), "sort (%s, %d threads)", title, num_threads);
+        rapl_report(&rapl, phase, &e0, &e1, n);
+        if (!fused) rapl_report(&rapl, "verify", &e1, &e2, n);
+    }
+    printf("Result: %s\n", v.sorted ? "SORTED" : "NOT SORTED");
+    printf("Checksum: %s (%016llx)\n", v.hash == in_hash ? "MATCH" : "MISMATCH",
+           (unsigned long long)v.hash);
 
-    free(arr);
+    free_aligned(arr);
     return 0;
 }
\ No newline at end of file
@@ -8,27 +8,37 @@
 #include <limits.h>
 #include <time.h>
 #include <sys/time.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
 
-/* swap two integers */
-static inline void swap_int(int *a, int *b) {
-    int t = *a;
-    *a = *b;
-    *b = t;
-}
+#include "../Common/bitonic_common.h"
+
+// Statistics counters (-DSORT_STATS): one global set
+#ifdef SORT_STATS
+static sort_stats_t sort_stats;
+
+static inline sort_stats_t *stat_self(void) { return &sort_stats; }
+
+void sort_stats_reset(void) { memset(&sort_stats, 0, sizeof(sort_stats)); }
+
+void sort_stats_get(sort_stats_t *out) { *out = sort_stats; }
+#endif
 
 // Bitonic merge: converts a bitonic sequence into monotonic sequence
 // compares and swaps elements at distance k apart, then recursively
 // direction: 1 for ascending, 0 for descending
-void bitonic_merge(int arr[], int low, int cnt, int dir) {
+void bitonic_merge(int arr[], size_t low, size_t cnt, int dir) {
+    if (cnt > MULTI_LEVEL_MIN) {
+        // out of cache: three levels per sweep, then eight independent sub-merges
+        size_t q = cnt / 8;
+        compare_exchange_radix8(&arr[low], q, q, dir);
+        for (size_t r = 0; r < 8; r++) bitonic_merge(arr, low + r * q, q, dir);
+        return;
+    }
     if (cnt > 1) {
-        int k = cnt / 2;
-        for (int i = low; i < low + k; i++) {
-            if (dir == 1) {                // ascending
-                if (arr[i] > arr[i + k]) swap_int(&arr[i], &arr[i + k]);
-            } else {                       // descending
-                if (arr[i] < arr[i + k]) swap_int(&arr[i], &arr[i + k]);
-            }
-        }
+        size_t k = cnt / 2;
+        compare_exchange_run(&arr[low], &arr[low + k], k, dir, 0);
         bitonic_merge(arr, low, k, dir);
         bitonic_merge(arr, low + k, k, dir);
     }
@@ -37,9 +47,9 @@ void bitonic_merge(int arr[], int low, int cnt, int dir) {
 // Bitonic sort: recursively creates bitonic sequences then merges them
 // Strategy: Sort first half ascending, second half descending to create bitonic sequence,
 // then merge entire sequence in desired direction
-void bitonic_sort_recursive(int arr[], int low, int cnt, int dir) {
+void bitonic_sort_recursive(int arr[], size_t low, size_t cnt, int dir) {
     if (cnt > 1) {
-        int k = cnt / 2;
+        size_t k = cnt / 2;
         // 1st half -> ascending, 2nd half -> descending to form bitonic seq
         bitonic_sort_recursive(arr, low, k, 1);
         bitonic_sort_recursive(arr, low + k, k, 0);
@@ -48,62 +58,256 @@ void bitonic_sort_recursive(int arr[], int low, int cnt, int dir) {
     }
 }
 
-// Bitonic sort requires array size to be power of 2
-// This finds the smallest power of 2 >= n
-int next_power_of_two(int n) {
-    if (n <= 1) return 1;
-    int p = 1;
-    while (p < n) p <<= 1;  // Left shift is equivalent to p *= 2
-    return p;
+// Other key widths: the recursive network per key type over the
+// compare-exchange kernels of Common/bitonic_common.h
+#define DEFINE_KEY_SORT(T, sfx)                                                             \
+void bitonic_merge_##sfx(T arr[], size_t low, size_t cnt, int dir) {                        \
+    if (cnt > 1) {                                                                          \
+        size_t k = cnt / 2;                                                                 \
+        compare_exchange_run_##sfx(&arr[low], &arr[low + k], k, dir);                       \
+        bitonic_merge_##sfx(arr, low, k, dir);                                              \
+        bitonic_merge_##sfx(arr, low + k, k, dir);                                          \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+void bitonic_sort_recursive_##sfx(T arr[], size_t low, size_t cnt, int dir) {               \
+    if (cnt > 1) {                                                                          \
+        size_t k = cnt / 2;                                                                 \
+        bitonic_sort_recursive_##sfx(arr, low, k, 1);                                       \
+        bitonic_sort_recursive_##sfx(arr, low + k, k, 0);                                   \
+        bitonic_merge_##sfx(arr, low, cnt, dir);                                            \
+    }                                                                                       \
+}
+
+DEFINE_KEY_SORT(int64_t, i64)
+DEFINE_KEY_SORT(uint16_t, u16)
+DEFINE_KEY_SORT(uint8_t, u8)
+DEFINE_KEY_SORT(key128_t, k128)
+
+// Eight-bit keys skip the network: a 256-bucket histogram, then each value
+// written out count times - two passes instead of O(log^2 n)
+void counting_sort_u8(uint8_t arr[], size_t n) {
+    size_t count[256] = { 0 };
+    for (size_t i = 0; i < n; i++) count[arr[i]]++;
+    size_t o = 0;
+    for (int v = 0; v < 256; v++) {
+        memset(arr + o, v, count[v]);
+        o += count[v];
+    }
+    STAT_PASS(1, 2 * n);
+}
+
+// Adaptive engine: the bitonic tree of Common/bitonic_common.h, merged and
+// sorted recursively
+void adaptive_merge(abtree_t *t, uint32_t root, uint32_t spare, int up) {
+    adaptive_half_clean(t, root, spare, up);
+    if (t->left[root] != AB_NIL) {
+        adaptive_merge(t, t->left[root], root, up);
+        adaptive_merge(t, t->right[root], spare, up);
+    }
+}
+
+void adaptive_sort_tree(abtree_t *t, uint32_t root, uint32_t spare, int up) {
+    if (2 * ((root + 1) & ~root) <= ADAPTIVE_BLOCK) return;   // block pre-sorted by the network
+    if (t->left[root] == AB_NIL) {
+        adaptive_half_clean(t, root, spare, up);
+        return;
+    }
+    adaptive_sort_tree(t, t->left[root], root, up);
+    adaptive_sort_tree(t, t->right[root], spare, !up);
+    adaptive_merge(t, root, spare, up);
 }
 
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
+// Sort arr[0..n) ascending (n a power of two, 2 <= n <= 2^32); 0 on success
+int bitonic_sort_adaptive(int arr[], size_t n) {
+    abtree_t t;
+    if (abtree_alloc(&t, n) != 0) return -1;
+    // Bottom levels: classic network on contiguous blocks, in the directions the
+    // tree recursion expects (a (subtree, spare) pair is still one aligned block)
+    size_t C = n < ADAPTIVE_BLOCK ? n : ADAPTIVE_BLOCK;
+    for (size_t lo = 0; lo < n; lo += C) {
+        int up = C == n || (lo / C) % 2 == 0;
+        bitonic_sort_recursive(arr, lo, C, up);
+    }
+    for (size_t i = 0; i < n; i++) abtree_node(&t, arr, i, n, C);
+
+    adaptive_sort_tree(&t, (uint32_t)(n / 2 - 1), (uint32_t)(n - 1), 1);
+
+    // In-order walk back into arr, spare last
+    uint32_t stack[64];
+    int top = 0;
+    size_t out = 0;
+    uint32_t node = (uint32_t)(n / 2 - 1);
+    while (node != AB_NIL || top > 0) {
+        while (node != AB_NIL) { stack[top++] = node; node = t.left[node]; }
+        node = stack[--top];
+        arr[out++] = ab_value(t.key[node]);
+        node = t.right[node];
+    }
+    arr[out] = ab_value(t.key[n - 1]);
+
+    abtree_free(&t);
+    return 0;
+}
+
+// Engine picked in main
+typedef struct {
+    int adaptive, small;
+} engine_t;
+
+// Sort the padded array with engine e (latency_bench calls it through ctx)
+void sort_padded(int arr[], size_t m, const void *ctx) {
+    const engine_t *e = ctx;
+    if (!e->adaptive && e->small && m <= SMALL_SORT_MAX) bitonic_sort_small(arr, m);
+    else if (!e->adaptive || bitonic_sort_adaptive(arr, m) != 0) bitonic_sort_recursive(arr, 0, m, 1);
+}
+
+// Key-type modes: key maps and padding from Common/bitonic_common.h around the
+// recursive networks; eight-bit keys take the counting sort unless --counting=off
+void sort_f32(int arr[], size_t n, size_t m, const engine_t *e) {
+    f32_to_keys(arr, n, m);
+    sort_padded(arr, m, e);
+    f32_from_keys(arr, n);
+}
+
+void sort_f64(int64_t arr[], size_t n, size_t m) {
+    f64_to_keys(arr, n, m);
+    bitonic_sort_recursive_i64(arr, 0, m, 1);
+    f64_from_keys(arr, n);
+}
+
+void sort_k128(key128_t arr[], size_t n, size_t m) {
+    pad_k128(arr, n, m);
+    bitonic_sort_recursive_k128(arr, 0, m, 1);
+}
+
+void sort_u16(uint16_t arr[], size_t n, size_t m) {
+    pad_u16(arr, n, m);
+    bitonic_sort_recursive_u16(arr, 0, m, 1);
+}
+
+void sort_u8(uint8_t arr[], size_t n, size_t m, int counting) {
+    if (counting) {
+        counting_sort_u8(arr, n);
+        return;
+    }
+    pad_u8(arr, n, m);
+    bitonic_sort_recursive_u8(arr, 0, m, 1);
 }
 
 int main(int argc, char *argv[]) {
-    int n = 1024;
-    if (argc > 1) n = atoi(argv[1]);
+    size_t n = 1024;
+
+    // Positional argument is n; options start with "--"
+    const char *engine = "classic";   // --engine=classic|adaptive|auto (= classic)
+    int latency_reps = 0;             // --latency=REPS: p50/p99 over REPS sorts
+    int small = 1;                    // --small=off: no small-input fast path
+    int energy = 0;                   // --energy: RAPL joules per phase
+    const char *keys = "int";         // --keys=int|float|double|u16|u8|uuid|pair
+    int counting = 1;                 // --counting=off: u8 keys through the network
+    for (int a = 1; a < argc; a++) {
+        if (strncmp(argv[a], "--engine=", 9) == 0) {
+            engine = argv[a] + 9;
+        } else if (strncmp(argv[a], "--latency=", 10) == 0) {
+            latency_reps = atoi(argv[a] + 10);
+        } else if (strncmp(argv[a], "--small=", 8) == 0) {
+            small = strcmp(argv[a] + 8, "off") != 0;
+        } else if (strcmp(argv[a], "--energy") == 0) {
+            energy = 1;
+        } else if (strncmp(argv[a], "--keys=", 7) == 0) {
+            keys = argv[a] + 7;
+        } else if (strncmp(argv[a], "--counting=", 11) == 0) {
+            counting = strcmp(argv[a] + 11, "off") != 0;
+        } else if (strncmp(argv[a], "--", 2) == 0) {
+            printf("Unknown option '%s'.\n", argv[a]);
+            printf("Usage: %s [n] [--engine=classic|adaptive|auto] [--latency=REPS] [--small=off] [--energy] "
+                   "[--keys=int|float|double|u16|u8|uuid|pair] [--counting=off]\n", argv[0]);
+            return 1;
+        } else {
+            long long v = atoll(argv[a]);
+            n = v > 0 ? (size_t)v : 0;
+        }
+    }
     
-    if (n <= 0) {
+    if (n == 0) {
         printf("Number of elements must be positive.\n");
         return 1;
     }
 
-    int m = next_power_of_two(n);
-    int *arr = malloc(sizeof(int) * m);
-    if (!arr) {
-        perror("malloc");
+    int kt = parse_key_type(keys);
+    if (kt < 0) {
+        printf("Unknown key type '%s' (int, float, double, u16, u8, uuid or pair).\n", keys);
+        return 1;
+    }
+
+    int adaptive = strcmp(engine, "adaptive") == 0;
+    if (!adaptive && strcmp(engine, "classic") != 0 && strcmp(engine, "auto") != 0) {
+        printf("Unknown engine '%s' (use classic, adaptive or auto).\n", engine);
         return 1;
     }
 
+    // Only int and float32 keys go through the int engines the adaptive sort replaces
+    size_t m = next_power_of_two(n);
+    if (m < 2 || m > ((size_t)1 << 32) || (kt != KEYS_INT && kt != KEYS_FLOAT)) adaptive = 0;
+    engine_t eng = { adaptive, small };
+
     srand(42); // Fixed seed for consistent results
-    for (int i = 0; i < n; i++) {
-        arr[i] = rand() % 10000;
+    if (latency_reps > 0) {
+        int ok = latency_bench(n, m, latency_reps, !adaptive && small && m <= SMALL_SORT_MAX ? "small" :
+                               adaptive ? "adaptive" : "classic", sort_padded, &eng);
+        printf("Result: %s\n", ok ? "SORTED" : "NOT SORTED");
+        return 0;
     }
-    for (int i = n; i < m; i++) arr[i] = INT_MAX;
 
-    printf("Serial Bitonic Sort - Array size: %d\n", n);
+    int *arr = aligned_buffer(key_width(kt) * m);
+    if (!arr) {
+        perror("aligned_buffer");
+        return 1;
+    }
+    uint64_t in_hash = fill_keys(kt, arr, n, m);
+
+    printf("Serial Bitonic Sort%s - Array size: %zu\n", adaptive ? " (Adaptive)" : "", n);
+    print_keys(kt, keys, counting);
+
+    rapl_t rapl;
+    rapl_sample_t e0, e1, e2;
+    if (energy && !rapl_open(&rapl)) printf("Energy: RAPL counters not readable under %s\n", RAPL_ROOT);
+    if (energy) rapl_read(&rapl, &e0);
+#ifdef SORT_STATS
+    sort_stats_reset();
+#endif
     
     double start_time = get_time();
-    bitonic_sort_recursive(arr, 0, m, 1);
+    if (kt == KEYS_DOUBLE) sort_f64((int64_t *)arr, n, m);
+    else if (kt == KEYS_U16) sort_u16((uint16_t *)arr, n, m);
+    else if (kt == KEYS_U8) sort_u8((uint8_t *)arr, n, m, counting);
+    else if (kt == KEYS_UUID || kt == KEYS_PAIR) sort_k128((key128_t *)arr, n, m);
+    else if (kt == KEYS_FLOAT) sort_f32(arr, n, m, &eng);
+    else sort_padded(arr, m, &eng);
     double end_time = get_time();
+    if (energy) rapl_read(&rapl, &e1);
     
     double execution_time = end_time - start_time;
     printf("Execution time: %.6f seconds\n", execution_time);
+#ifdef SORT_STATS
+    sort_stats_t stats;
+    sort_stats_get(&stats);
+    sort_stats_print(&stats, m, 0);
+#endif
     
-    // Verify sorting
-    int sorted = 1;
-    for (int i = 1; i < n; i++) {
-        if (arr[i-1] > arr[i]) {
-            sorted = 0;
-            break;
-        }
+    // Verify order and permutation in one pass
+    verify_t v;
+    verify_keys(kt, arr, n, m, &v);
+    if (energy) {
+        rapl_read(&rapl, &e2);
+        rapl_report(&rapl, adaptive ? "sort (adaptive, 1 thread)" : small && m <= SMALL_SORT_MAX ?
+                    "sort (small, 1 thread)" : "sort (classic, 1 thread)", &e0, &e1, n);
+        rapl_report(&rapl, "verify", &e1, &e2, n);
     }
-    printf("Result: %s\n", sorted ? "SORTED" : "NOT SORTED");
+    printf("Result: %s\n", v.sorted ? "SORTED" : "NOT SORTED");
+    printf("Checksum: %s (%016llx)\n", v.hash == in_hash ? "MATCH" : "MISMATCH",
+           (unsigned long long)v.hash);
 
-    free(arr);
+    free_aligned(arr);
     return 0;
 }